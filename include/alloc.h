@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstddef>
+
+// number of global operator new calls made so far
+size_t alloc_count();
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <ctime>
+#include <unordered_map>
+
+// every executable on a $PATH, sorted by name, first directory wins
+// built and refreshed by the suggester thread, read by the shell too
+struct ExecIndex
+{
+    std::mutex lock;
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::string path;
+    std::vector<std::pair<std::string, timespec>> dirs;
+
+    bool fresh(const std::string& env_path);
+    void rebuild(const std::string& env_path);
+
+    bool find(const std::string& env_path, const std::string& name, std::string& full);
+    bool complete(const std::string& prefix, std::string& match);
+};
+
+// maps command names to the absolute path found in $PATH
+struct Commands
+{
+    std::unordered_map<std::string, std::string> data;
+    std::shared_ptr<ExecIndex> index = std::make_shared<ExecIndex>();
+
+    // off in forked children, the suggester may have held the lock at fork time
+    bool use_index = true;
+
+    bool find(const std::string& name, std::string& path);
+    void clear();
+
+    bool contains(const std::string& name);
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+#include <cstdint>
+
+// sorted directory listings, rescanned only when the directory changes
+// changes come from inotify, or from the mtime when a watch can't be added
+struct DirCache
+{
+    static constexpr size_t MAX_LISTINGS = 64;
+
+    struct Listing
+    {
+        std::vector<std::string> entries;
+        timespec mtime{};
+        int wd = -1;
+        bool stale = false;
+        uint64_t used = 0;
+    };
+
+    std::unordered_map<std::string, Listing> data;
+    std::unordered_map<int, std::string> watches;
+    int inotify_fd = -1;
+    uint64_t clock = 0;
+
+    DirCache();
+    ~DirCache();
+
+    bool find(const std::string& path, const std::string& prefix, std::string& match);
+    const Listing* get(const std::string& path);
+
+    void read_events();
+    bool scan(const std::string& path, Listing& listing);
+    void evict();
+};
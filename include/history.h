@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cstdint>
+
+// radix tree over the entries, every node remembers the most
+// recent entry below it so a prefix lookup is a single walk down
+struct PrefixIndex
+{
+    struct Node
+    {
+        std::string label;
+        std::vector<std::unique_ptr<Node>> children;
+        size_t count = 0;
+        uint64_t best = 0;
+        std::string_view text;
+
+        Node* child(char ch) const;
+    };
+
+    Node root;
+
+    void insert(std::string_view entry, uint64_t seq);
+    void erase(std::string_view entry);
+    bool find(std::string_view prefix, std::string_view& match) const;
+};
+
+// ring buffer of the last entries, backed by an append-only file
+// entries from the file are views into one buffer read at startup,
+// entries added later are owned by the deque, oldest first
+struct History
+{
+    std::vector<std::string_view> ring;
+    size_t head = 0;
+    size_t count = 0;
+
+    std::string loaded;
+    size_t loaded_alive = 0;
+    std::deque<std::string> added;
+
+    std::string path;
+    int fd = -1;
+    size_t appends = 0;
+
+    PrefixIndex index;
+    uint64_t pushed = 0;
+
+    void load(const std::string& file, size_t capacity);
+    void add(const std::string& entry, size_t capacity);
+    void resize(size_t capacity);
+    void compact();
+    void clear();
+
+    // most recent entry that starts with prefix and is longer than it
+    bool find_prefix(std::string_view prefix, std::string_view& match) const { return index.find(prefix, match); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // 0 is the oldest entry
+    std::string_view operator[](size_t index) const { return ring[(head + index) % ring.size()]; }
+    std::string_view back() const { return (*this)[count - 1]; }
+
+    void push(std::string_view entry);
+    void evict();
+};
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <string>
-#include <dirent.h>
+#include <vector>
+#include <poll.h>
+#include <suggester.h>
 #include <terminal.h>
 
 #define CTRL_KEY(key) ((key) & 0x1f)
@@ -25,7 +27,8 @@ enum Key
     SHIFT_CTRL_ARROW_RIGHT,
     SHIFT_CTRL_ARROW_LEFT,
     SHIFT_HOME,
-    SHIFT_END
+    SHIFT_END,
+    PASTE
 };
 
 struct Shell;
@@ -37,23 +40,57 @@ struct Input
     std::string backup;
     std::string suggestion;
 
+    Suggester suggester;
+    uint64_t generation = 0;
+    std::string suggestion_base;
+
+    char in_buffer[4096];
+    size_t in_pos = 0;
+    size_t in_len = 0;
+
     size_t input_anchor;
     size_t cursor;
     size_t selection_anchor;
     bool selection;
     int hist_index = -1;
 
-    int last_render_size;
-    size_t last_cursor;
+    // keys that arrive together are applied before the suggestion and the
+    // frame catch up, the suggestion is out of date while this is set
+    bool behind = false;
+
+    // what the terminal shows right now, one cell per byte from input_anchor
+    struct Cell
+    {
+        char ch;
+        char style;
+
+        bool operator==(const Cell& other) const { return ch == other.ch && style == other.style; }
+    };
+
+    std::vector<Cell> screen;
+    winsize layout{};
+
+    // where the terminal cursor is, in cells from the start of the row
+    // the line begins on, input_anchor being the column after the prompt
+    size_t screen_pos = 0;
+    bool wrap_pending = false;
+
+    // rows from where the prompt starts down to input_anchor
+    size_t prompt_rows = 0;
 
     Input(Shell* _sh) : sh(_sh) {};
 
     bool get();
+    void write_prompt(std::string& output);
+    void repaint_prompt();
 
+    int read_byte();
+    bool pending();
     int get_key();
     int process_key();
 
     void insert(int ch);
+    void paste();
     void backspace();
     void delete_();
     void delete_selection();
@@ -62,6 +99,10 @@ struct Input
     void enter();
 
     void find_suggestion();
+    void request_suggestion(const std::string& path, const std::string& word, const std::string& previous, std::shared_ptr<ExecIndex> index = nullptr);
+    bool command_position(size_t pos);
+    void take_suggestion();
+    int suggest_wait();
     void autocomplete();
 
     void move_home(bool shift);
@@ -78,5 +119,7 @@ struct Input
 
     void select_all();
 
-    void render();
+    void move_to(size_t target, std::string& output);
+    void relayout(const winsize& size, std::string& output);
+    void render(std::string output = "");
 };
\ No newline at end of file
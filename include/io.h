@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string_view>
+
+// writes all of data to fd, false if a write fails for good
+bool write_all(int fd, std::string_view data);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+#include <termios.h>
+#include <signal.h>
+#include <sys/types.h>
+
+// a pipeline or a background command, pgid is 0 without job control
+struct Job
+{
+    enum State
+    {
+        RUNNING,
+        STOPPED,
+        DONE
+    };
+
+    int id = 0;
+    pid_t pgid = 0;
+    // one per stage, -1 for one that failed to start
+    std::vector<pid_t> pids;
+    // wait status of each stage, -1 while it runs
+    std::vector<int> statuses;
+    // stages not reaped yet, the last stage's status is the job's
+    size_t left = 0;
+    int status = 0;
+    State state = RUNNING;
+    std::string command;
+
+    // higher is more recent, picks the jobs %+ and %- stand for
+    uint64_t seq = 0;
+    bool notified = false;
+
+    // what a stopped job had the terminal set to
+    bool has_modes = false;
+    termios modes{};
+
+    void start(pid_t pid);
+};
+
+// children are reaped with waitpid(-1) as they change state, which job
+// and stage each pid is comes from a map, so a change costs a lookup
+// however many children there are
+struct Jobs
+{
+    std::vector<Job> list;
+    uint64_t seq = 0;
+
+    // job id and stage of every process in the table still running
+    std::unordered_map<pid_t, std::pair<int, size_t>> owners;
+    // changes of children outside any job, kept until waited for
+    std::unordered_map<pid_t, int> unclaimed;
+
+    Job& add(Job job);
+    void remove(int id);
+    void touch(Job& job);
+
+    Job* get(int id);
+    Job* find(const std::string& spec);
+    Job* current();
+    Job* previous();
+    char mark(const Job& job);
+
+    void update(Job& job, size_t stage, int status);
+    void file(pid_t pid, int status);
+    void reap();
+    int wait_child(pid_t pid);
+};
+
+pid_t next_child(bool block, int& status);
+int exit_code(int status);
+std::string describe(const Job& job);
+
+void watch_children();
+int children_fd();
+bool take_children();
@@ -1,14 +1,17 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <algorithm>
 #include <exception>
 #include <memory>
 #include <vector>
+#include <cstdint>
 
-struct AST;
-typedef std::unique_ptr<AST> AST_ptr;
+// nodes are referenced by their index in the arena
+// index 0 is reserved so that a null id tests false
+typedef uint32_t AST_id;
 
 struct AST
 {
@@ -24,36 +27,78 @@ struct AST
         WORD,
         PIPE,
         LOGICAL,
-        COMMA
+        COMMA,
+        BACKGROUND,
+        // one redirection like 2> or 2>&1 in data, the command or an inner
+        // redirection as first child and the target word, if any, after it
+        REDIRECT,
+        // unquoted text with wildcards, made from REGULAR before expansion
+        GLOB
     } type;
 
-    std::string data;
-    std::vector<AST_ptr> children;
+    // points into the source line or into the arena's string blocks
+    std::string_view data;
 
-    AST(NodeType _type, const std::string& _data)
+    AST_id first = 0;
+    AST_id last = 0;
+    AST_id next = 0;
+    uint32_t count = 0;
+
+    AST(NodeType _type, std::string_view _data)
         : type(_type), data(_data) {}
+};
+
+// bump allocator owning every node and string of one command
+// reset() drops everything at once but keeps the memory for the next command
+struct Arena
+{
+    static constexpr size_t BLOCK_SIZE = 4096;
+
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<AST> nodes;
+    std::vector<Block> blocks;
+    size_t block = 0;
+    size_t used = 0;
+
+    Arena();
+
+    AST& operator[](AST_id id) { return nodes[id]; }
+
+    AST_id make(AST::NodeType type, std::string_view data = "");
+    void append(AST_id parent, AST_id child);
+    void clear_children(AST_id parent);
+
+    void* alloc(size_t size, size_t align = 1);
+    std::string_view store(std::string_view str);
+    const char* c_str(std::string_view str);
 
-    AST(NodeType _type, const std::string& _data, std::vector<AST_ptr>&& _children)
-        : type(_type), data(_data), children(std::move(_children)) {}
+    void reset();
 
-    void print(int tabs = 0);
+    void print(AST_id id, int tabs = 0);
 };
 
-AST_ptr parse_shell_input(std::string& input);
+AST_id parse_shell_input(Arena& arena, std::string_view& input);
 
-AST_ptr parse_command_list(std::string& input);
-AST_ptr parse_command_logical(std::string& input);
-AST_ptr parse_command_pipe(std::string& input);
-AST_ptr parse_command(std::string& input);
+AST_id parse_command_list(Arena& arena, std::string_view& input);
+AST_id parse_command_logical(Arena& arena, std::string_view& input);
+AST_id parse_command_pipe(Arena& arena, std::string_view& input);
+AST_id parse_command(Arena& arena, std::string_view& input);
+AST_id parse_redirect(Arena& arena, std::string_view& input, AST_id inner);
 
-AST_ptr parse_word(std::string& input);
-AST_ptr parse_regular(std::string& input);
-AST_ptr parse_subcommand(std::string& input);
-AST_ptr parse_sq_string(std::string& input);
-AST_ptr parse_var(std::string& input);
-AST_ptr parse_tilde(std::string& input);
-AST_ptr parse_escape(std::string& input);
+AST_id parse_word(Arena& arena, std::string_view& input);
+AST_id parse_regular(Arena& arena, std::string_view& input);
+AST_id parse_subcommand(Arena& arena, std::string_view& input);
+AST_id parse_sq_string(Arena& arena, std::string_view& input);
+AST_id parse_var(Arena& arena, std::string_view& input);
+AST_id parse_tilde(Arena& arena, std::string_view& input);
+AST_id parse_escape(Arena& arena, std::string_view& input);
 
-AST_ptr parse_comma(std::string& input);
-AST_ptr parse_logic(std::string& input);
-AST_ptr parse_pipe(std::string& input);
\ No newline at end of file
+AST_id parse_comma(Arena& arena, std::string_view& input);
+AST_id parse_background(Arena& arena, std::string_view& input);
+AST_id parse_logic(Arena& arena, std::string_view& input);
+AST_id parse_pipe(Arena& arena, std::string_view& input);
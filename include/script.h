@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <sys/stat.h>
+#include <parser.h>
+
+// a script parsed once, the tree of every line is kept in a compact
+// pre-order encoding with its text stored as offsets into the source,
+// so it can be saved as is and loaded into an arena without parsing
+struct Script
+{
+    struct Line
+    {
+        uint32_t offset;
+        uint32_t size;
+        // how much of the line the parser consumed, for error carets
+        uint32_t parsed;
+        // lines that failed to parse are parsed again when run to report it
+        uint32_t error;
+        // where the encoded tree starts in code, empty for no tree
+        uint32_t code_offset;
+        uint32_t code_size;
+    };
+
+    std::string text;
+    std::vector<Line> lines;
+    std::string code;
+
+    bool read(const std::string& path);
+    void compile();
+
+    bool load_cache(const std::string& cache, const std::string& key, const struct stat& st);
+    void save_cache(const std::string& cache, const std::string& key, const struct stat& st) const;
+
+    std::string_view line(size_t i) const;
+    AST_id load(size_t i, Arena& arena) const;
+};
@@ -2,54 +2,158 @@
 
 #include <unistd.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <wait.h>
+#include <spawn.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <deque>
 #include <functional>
 #include <cstring>
+#include <cinttypes>
+#include <charconv>
+#include <chrono>
 #include <vars.h>
 #include <alias.h>
+#include <commands.h>
+#include <history.h>
 #include <parser.h>
+#include <alloc.h>
 #include <input.h>
+#include <script.h>
+#include <jobs.h>
+#include <wildcard.h>
+
+// a command substitution in flight, output is collected
+// from the pipes when it runs in a child
+struct Substitution
+{
+    AST_id tree = 0;
+    pid_t pid = -1;
+    int out = -1;
+    int err = -1;
+    std::string output;
+    std::string errors;
+    int status = 0;
+
+    Substitution() = default;
+    Substitution(AST_id _tree)
+        : tree(_tree) {}
+};
+
+// a redirection of a command, files are opened by the shell beforehand so
+// every one ends up as src dup'd onto fd in whatever runs the command
+struct Redirect
+{
+    int fd;
+    int src;
+    // src was opened for it and is closed once the command started
+    bool opened;
+};
+
+// one input of parallel, its output waits here until all
+// the output of the inputs before it is out
+struct ParallelTask
+{
+    pid_t pid = -1;
+    int out = -1;
+    int err = -1;
+    std::string output;
+    std::string errors;
+    int status = -1;
+};
 
 struct Shell
 {
     bool print_tree = false;
+    bool print_allocs = false;
 
     std::string name;
     Vars vars;
     Aliases aliases;
+    Commands commands;
     std::unordered_map < std::string, std::function<int(int, char**)>> builtins;
-    std::vector<std::string> history;
+    std::unordered_set<std::string> pure_builtins;
+    History history;
     Input input{ this };
 
+    // the last complete prompt and the child working on the next one
+    std::string prompt_text = "> ";
+    Substitution prompt_job;
+
+    // background and stopped jobs, job control is only on when interactive
+    Jobs jobs;
+    bool job_control = false;
+    pid_t shell_pgid = 0;
+    termios shell_modes{};
+
+    // exit status of every stage of the last foreground pipeline
+    std::vector<int> pipestatus;
+
+    // the real streams, in-process substitutions swap them out
+    std::streambuf* stdout_buf = nullptr;
+    std::streambuf* stderr_buf = nullptr;
+
+    // one arena per nesting level of execute
+    std::vector<std::unique_ptr<Arena>> arenas;
+    size_t arena_depth = 0;
+
     Shell(const std::string& _name) : name(_name) {};
 
     void run();
     void run_file(int argc, char** argv);
     void execute(std::string input, bool save_status = true);
+    void execute_parsed(Arena& arena, AST_id tree, bool save_status, size_t allocs);
+    void report_error(std::string_view input, size_t pos, const std::runtime_error& e);
 
     void sync_vars();
+    size_t hist_size();
+    std::string history_path();
+    std::string cache_path(const std::string& dir, const std::string& key);
     void add_history(std::string str);
     std::string get_history(size_t index);
-    void prompt();
+    int prompt_wait();
+    void start_prompt();
+    bool poll_prompt(int timeout);
+    void stop_prompt();
+    std::string capture(const std::string& input, int& status);
     void init();
+    void init_job_control();
+    void become_child();
+    void notify_jobs();
+
+    Arena& acquire_arena();
+    void release_arena();
 
-    std::vector<std::string> get_sub_lines(const std::string& input);
+    bool runs_in_process(Arena& arena, AST_id tree);
+    void find_substitutions(Arena& arena, AST_id tree, std::vector<Substitution>& subs);
+    void start_substitution(Arena& arena, Substitution& sub);
+    void collect_substitutions(std::vector<Substitution>& subs);
 
-    void make_regular(AST_ptr& leaf);
-    std::vector<AST_ptr> expand_word(const AST_ptr& word);
-    void sub_commands(AST_ptr& tree);
+    void make_regular(Arena& arena, AST_id leaf);
+    void expand_word(Arena& arena, AST_id word, AST_id command, const std::vector<std::vector<std::string_view>>& lines, size_t& next, size_t& budget);
+    size_t arg_limit();
+    void sub_commands(Arena& arena, AST_id tree);
+    void expand_commands(Arena& arena, AST_id tree, const std::vector<std::vector<std::string_view>>& lines, size_t& next);
 
-    int execute_tree(const AST_ptr& tree);
-    int execute_command(const AST_ptr& command);
-    int execute_pipeline(const AST_ptr& pipeline);
+    int execute_tree(Arena& arena, AST_id tree);
+    int execute_command(Arena& arena, AST_id tree);
+    AST_id open_redirects(Arena& arena, AST_id tree, std::vector<Redirect>& redirects);
+    int execute_pipeline(Arena& arena, AST_id pipeline);
+    int execute_background(Arena& arena, AST_id background);
+    int wait_foreground(Job job);
+    void start_task(Arena& arena, AST_id tree, const std::vector<std::string>* words, const std::string& input, ParallelTask& task);
 
+    bool use_spawn();
     bool is_builtin(const std::string& name);
-    bool is_executable(const std::string& name);
-    int exec_and_return(int argc, char** argv);
+    bool is_executable(const std::string& name, std::string& path);
+    int exec_and_return(int argc, char** argv, const std::vector<Redirect>& redirects = {});
     void exec_and_exit(int argc, char** argv);
+    void exec_tree_and_exit(Arena& arena, AST_id tree);
 
     int __exit(int argc, char** argv);
     int __cd(int argc, char** argv);
@@ -59,4 +163,17 @@ struct Shell
     int __alias(int argc, char** argv);
     int __unalias(int argc, char** argv);
     int __history(int argc, char** argv);
+    int __hash(int argc, char** argv);
+    int __suggestions(int argc, char** argv);
+    int __printf(int argc, char** argv);
+    int __echo(int argc, char** argv);
+    int __true(int argc, char** argv);
+    int __false(int argc, char** argv);
+    int __test(int argc, char** argv);
+    int __memo(int argc, char** argv);
+    int __jobs(int argc, char** argv);
+    int __fg(int argc, char** argv);
+    int __bg(int argc, char** argv);
+    int __wait(int argc, char** argv);
+    int __parallel(int argc, char** argv);
 };
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <dircache.h>
+#include <commands.h>
+
+// finds file suggestions on a background thread, so a slow filesystem
+// delays the suggestion instead of the keystroke
+// every request carries a generation, answers to older ones are dropped
+struct Suggester
+{
+    // shared with the thread, which is detached and may outlive us
+    struct State
+    {
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+        DirCache dirs;
+
+        bool pending = false;
+        uint64_t generation = 0;
+        std::string path;
+        std::string word;
+        std::shared_ptr<ExecIndex> index;
+
+        bool ready = false;
+        uint64_t result_generation = 0;
+        std::string result;
+
+        int event_fd = -1;
+        bool stop = false;
+    };
+
+    std::shared_ptr<State> state;
+    uint64_t waiting_for = 0;
+
+    size_t requests = 0;
+    size_t late = 0;
+    size_t dropped = 0;
+
+    ~Suggester();
+
+    int fd();
+
+    // with an index, word is a command name and path is $PATH
+    void post(uint64_t generation, const std::string& path, const std::string& word, std::shared_ptr<ExecIndex> index = nullptr);
+    bool wait(uint64_t generation, int ms, std::string& entry);
+    bool take(uint64_t& generation, std::string& entry);
+
+    static void run(std::shared_ptr<State> state);
+};
@@ -1,14 +1,30 @@
 #pragma once
 
 #include <iostream>
+#include <string>
+#include <string_view>
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <signal.h>
+
+// window geometry is read once and then again only after a SIGWINCH,
+// the handler also writes to a pipe so a waiting editor wakes up
+struct Terminal
+{
+    winsize size{};
+    volatile sig_atomic_t stale = 1;
+    int resize_pipe[2] = { -1, -1 };
+};
+
+extern Terminal terminal;
 
 void tty_raw();
 void tty_restore();
 
-void set_cursor(size_t pos);
-size_t get_cursor();
+void watch_resize();
+int resize_fd();
+bool take_resize();
 
-void ajust_for_scroll(size_t* anchor, size_t offset);
\ No newline at end of file
+const winsize& get_size();
+size_t end_column(std::string_view text, size_t cols, size_t& rows);
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -8,8 +10,12 @@ struct Vars
     std::unordered_map<std::string, std::string> data;
     std::unordered_set<std::string> exported;
 
+    // called with the name of every variable that is set or unset
+    std::function<void(const std::string&)> on_change;
+
     void set(const std::string& name, const std::string& value);
     bool get(const std::string& name, std::string& value);
+    long long get_number(const std::string& name, long long fallback);
     bool unset(const std::string& name);
 
     bool export_(const std::string& name);
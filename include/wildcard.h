@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// *, ? and [...] match within one path component and never a leading dot
+// unless the pattern has one, ** as a whole component matches any number
+// of directories, which are read by a pool of threads, a backslash makes
+// the next character literal
+bool has_wildcard(std::string_view pattern);
+bool wildcard_match(std::string_view pattern, std::string_view name);
+
+// paths matching the pattern sorted bytewise, empty when none do
+std::vector<std::string> expand_wildcard(std::string_view pattern);
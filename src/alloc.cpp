@@ -0,0 +1,33 @@
+#include <alloc.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> allocations{ 0 };
+
+size_t alloc_count()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    void* ptr = malloc(size ? size : 1);
+
+    if (!ptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
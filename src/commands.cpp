@@ -0,0 +1,188 @@
+#include <commands.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <cstdlib>
+
+bool is_regular_executable(const std::string& path)
+{
+    struct stat file_stat;
+
+    return stat(path.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode) && (file_stat.st_mode & S_IXUSR);
+}
+
+std::vector<std::string> split_path(const std::string& env_path)
+{
+    std::vector<std::string> dirs;
+    size_t start = 0;
+
+    while (start <= env_path.size())
+    {
+        size_t end = env_path.find(':', start);
+
+        if (end == std::string::npos)
+            end = env_path.size();
+
+        dirs.push_back(env_path.substr(start, end - start));
+
+        start = end + 1;
+    }
+
+    return dirs;
+}
+
+timespec dir_mtime(const std::string& dir)
+{
+    struct stat dir_stat;
+
+    if (stat(dir.c_str(), &dir_stat) == -1)
+        return timespec{};
+
+    return dir_stat.st_mtim;
+}
+
+// only stats the directories, the lock isn't held while doing so
+bool ExecIndex::fresh(const std::string& env_path)
+{
+    std::vector<std::pair<std::string, timespec>> built;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (path != env_path || dirs.empty())
+            return false;
+
+        built = dirs;
+    }
+
+    for (const auto& dir : built)
+    {
+        timespec mtime = dir_mtime(dir.first);
+
+        if (mtime.tv_sec != dir.second.tv_sec || mtime.tv_nsec != dir.second.tv_nsec)
+            return false;
+    }
+
+    return true;
+}
+
+void ExecIndex::rebuild(const std::string& env_path)
+{
+    std::vector<std::pair<std::string, std::string>> found;
+    std::vector<std::pair<std::string, timespec>> scanned;
+
+    for (const auto& dir : split_path(env_path))
+    {
+        // mtime first, a change during the scan makes the next check fail
+        scanned.push_back({ dir, dir_mtime(dir) });
+
+        DIR* handle = opendir(dir.c_str());
+
+        if (!handle)
+            continue;
+
+        dirent* entry;
+
+        while ((entry = readdir(handle)) != NULL)
+        {
+            if (entry->d_name[0] == '.' || entry->d_type == DT_DIR)
+                continue;
+
+            struct stat file_stat;
+
+            if (fstatat(dirfd(handle), entry->d_name, &file_stat, 0) == 0 && S_ISREG(file_stat.st_mode) && (file_stat.st_mode & S_IXUSR))
+                found.push_back({ entry->d_name, dir + '/' + entry->d_name });
+        }
+
+        closedir(handle);
+    }
+
+    // stable so the earlier directory stays first for each name
+    std::stable_sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    found.erase(std::unique(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first == b.first; }), found.end());
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    entries = std::move(found);
+    dirs = std::move(scanned);
+    path = env_path;
+}
+
+bool ExecIndex::find(const std::string& env_path, const std::string& name, std::string& full)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (path != env_path)
+        return false;
+
+    auto it = std::lower_bound(entries.begin(), entries.end(), name, [](const auto& entry, const std::string& n) { return entry.first < n; });
+
+    if (it == entries.end() || it->first != name)
+        return false;
+
+    full = it->second;
+
+    return true;
+}
+
+bool ExecIndex::complete(const std::string& prefix, std::string& match)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = std::lower_bound(entries.begin(), entries.end(), prefix, [](const auto& entry, const std::string& p) { return entry.first < p; });
+
+    if (it == entries.end() || it->first.compare(0, prefix.size(), prefix) != 0)
+        return false;
+
+    match = it->first;
+
+    return true;
+}
+
+bool Commands::find(const std::string& name, std::string& path)
+{
+    auto it = data.find(name);
+
+    if (it != data.end())
+    {
+        path = it->second;
+        return true;
+    }
+
+    const char* env_path = getenv("PATH");
+
+    if (!env_path)
+        return false;
+
+    // an index miss may just be a new file, so PATH is still walked
+    if (use_index && index->find(env_path, name, path) && is_regular_executable(path))
+    {
+        data[name] = path;
+        return true;
+    }
+
+    for (const auto& dir : split_path(env_path))
+    {
+        std::string file_path = dir + '/' + name;
+
+        if (is_regular_executable(file_path))
+        {
+            data[name] = file_path;
+            path = file_path;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Commands::clear()
+{
+    data.clear();
+}
+
+bool Commands::contains(const std::string& name)
+{
+    return data.find(name) != data.end();
+}
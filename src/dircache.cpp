@@ -0,0 +1,241 @@
+#include <dircache.h>
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+DirCache::DirCache()
+{
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+DirCache::~DirCache()
+{
+    if (inotify_fd != -1)
+        close(inotify_fd);
+}
+
+// absolute path without . components and repeated slashes, .. is kept
+// since it has to go through symlinks the same way opendir does
+std::string absolute_path(const std::string& path)
+{
+    std::string full = path;
+
+    if (full.empty() || full[0] != '/')
+    {
+        char* cwd = getcwd(nullptr, 0);
+
+        if (!cwd)
+            return "";
+
+        full = std::string(cwd) + '/' + path;
+        free(cwd);
+    }
+
+    std::string ret;
+    size_t start = 0;
+
+    while (start < full.size())
+    {
+        size_t end = full.find('/', start);
+
+        if (end == std::string::npos)
+            end = full.size();
+
+        std::string part = full.substr(start, end - start);
+
+        if (!part.empty() && part != ".")
+            ret += '/' + part;
+
+        start = end + 1;
+    }
+
+    return ret.empty() ? "/" : ret;
+}
+
+bool DirCache::find(const std::string& path, const std::string& prefix, std::string& match)
+{
+    const Listing* listing = get(path);
+
+    if (!listing)
+        return false;
+
+    auto it = std::lower_bound(listing->entries.begin(), listing->entries.end(), prefix);
+
+    if (it == listing->entries.end() || it->compare(0, prefix.size(), prefix) != 0)
+        return false;
+
+    match = *it;
+
+    return true;
+}
+
+const DirCache::Listing* DirCache::get(const std::string& path)
+{
+    read_events();
+
+    std::string key = absolute_path(path);
+
+    if (key.empty())
+        return nullptr;
+
+    auto it = data.find(key);
+
+    if (it != data.end())
+    {
+        Listing& listing = it->second;
+
+        if (listing.wd == -1)
+        {
+            struct stat dir_stat;
+
+            if (stat(key.c_str(), &dir_stat) == -1)
+            {
+                data.erase(it);
+                return nullptr;
+            }
+
+            if (dir_stat.st_mtim.tv_sec != listing.mtime.tv_sec || dir_stat.st_mtim.tv_nsec != listing.mtime.tv_nsec)
+                listing.stale = true;
+        }
+
+        if (listing.stale && !scan(key, listing))
+            return nullptr;
+
+        listing.used = ++clock;
+
+        return &listing;
+    }
+
+    if (data.size() >= MAX_LISTINGS)
+        evict();
+
+    Listing& listing = data[key];
+
+    // watch before scanning so no change can slip in between
+    if (inotify_fd != -1)
+    {
+        int wd = inotify_add_watch(inotify_fd, key.c_str(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+
+        // another spelling of an already watched directory keeps using mtime
+        if (wd != -1 && watches.find(wd) == watches.end())
+        {
+            listing.wd = wd;
+            watches[wd] = key;
+        }
+    }
+
+    if (!scan(key, listing))
+    {
+        if (listing.wd != -1)
+        {
+            inotify_rm_watch(inotify_fd, listing.wd);
+            watches.erase(listing.wd);
+        }
+
+        data.erase(key);
+
+        return nullptr;
+    }
+
+    listing.used = ++clock;
+
+    return &listing;
+}
+
+void DirCache::read_events()
+{
+    if (inotify_fd == -1)
+        return;
+
+    alignas(inotify_event) char buffer[4096];
+    ssize_t len;
+
+    while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char* ptr = buffer; ptr < buffer + len; ptr += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(ptr)->len)
+        {
+            const inotify_event* event = reinterpret_cast<inotify_event*>(ptr);
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                for (auto& pair : data)
+                    pair.second.stale = true;
+
+                continue;
+            }
+
+            auto it = watches.find(event->wd);
+
+            if (it == watches.end())
+                continue;
+
+            Listing& listing = data[it->second];
+
+            listing.stale = true;
+
+            if (event->mask & IN_IGNORED)
+            {
+                listing.wd = -1;
+                watches.erase(it);
+            }
+        }
+    }
+}
+
+bool DirCache::scan(const std::string& path, Listing& listing)
+{
+    DIR* dir = opendir(path.c_str());
+
+    if (!dir)
+        return false;
+
+    struct stat dir_stat;
+
+    if (fstat(dirfd(dir), &dir_stat) == 0)
+        listing.mtime = dir_stat.st_mtim;
+
+    listing.entries.clear();
+
+    dirent* entry;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string name = std::string(entry->d_name);
+
+        if (entry->d_type == DT_DIR)
+            name += '/';
+
+        listing.entries.push_back(name);
+    }
+
+    closedir(dir);
+
+    std::sort(listing.entries.begin(), listing.entries.end());
+
+    listing.stale = false;
+
+    return true;
+}
+
+void DirCache::evict()
+{
+    auto oldest = data.begin();
+
+    for (auto it = data.begin(); it != data.end(); it++)
+        if (it->second.used < oldest->second.used)
+            oldest = it;
+
+    if (oldest == data.end())
+        return;
+
+    if (oldest->second.wd != -1)
+    {
+        inotify_rm_watch(inotify_fd, oldest->second.wd);
+        watches.erase(oldest->second.wd);
+    }
+
+    data.erase(oldest);
+}
@@ -0,0 +1,343 @@
+#include <history.h>
+#include <io.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+// offset where the last n lines of data start
+size_t tail_offset(const char* data, size_t size, size_t lines)
+{
+    size_t end = size;
+
+    // a trailing newline doesn't start another line
+    if (end > 0 && data[end - 1] == '\n')
+        end--;
+
+    while (end > 0)
+    {
+        const char* nl = static_cast<const char*>(memrchr(data, '\n', end));
+
+        if (!nl)
+            return 0;
+
+        if (--lines == 0)
+            return nl - data + 1;
+
+        end = nl - data;
+    }
+
+    return 0;
+}
+
+// copies the last n lines of the file, the file is only mapped for the scan
+std::string read_tail(int fd, size_t lines, size_t* skipped)
+{
+    struct stat file_stat;
+    *skipped = 0;
+
+    if (lines == 0 || fstat(fd, &file_stat) == -1 || file_stat.st_size == 0)
+        return "";
+
+    size_t size = file_stat.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED)
+        return "";
+
+    const char* data = static_cast<const char*>(map);
+    size_t offset = tail_offset(data, size, lines);
+
+    std::string tail(data + offset, size - offset);
+
+    munmap(map, size);
+
+    *skipped = offset;
+
+    return tail;
+}
+
+PrefixIndex::Node* PrefixIndex::Node::child(char ch) const
+{
+    for (const auto& c : children)
+        if (c->label[0] == ch)
+            return c.get();
+
+    return nullptr;
+}
+
+void PrefixIndex::insert(std::string_view entry, uint64_t seq)
+{
+    Node* node = &root;
+    size_t pos = 0;
+
+    // a new entry is always the most recent one on its path
+    node->count++;
+    node->best = seq;
+    node->text = entry;
+
+    while (pos < entry.size())
+    {
+        std::string_view rest = entry.substr(pos);
+        Node* next = node->child(rest[0]);
+
+        if (!next)
+        {
+            auto leaf = std::make_unique<Node>();
+
+            leaf->label = rest;
+            leaf->count = 1;
+            leaf->best = seq;
+            leaf->text = entry;
+
+            node->children.push_back(std::move(leaf));
+
+            return;
+        }
+
+        size_t common = 0;
+
+        while (common < next->label.size() && common < rest.size() && next->label[common] == rest[common])
+            common++;
+
+        if (common < next->label.size())
+        {
+            // split the edge where the entry leaves it
+            auto mid = std::make_unique<Node>();
+
+            mid->label = next->label.substr(0, common);
+            mid->count = next->count;
+            mid->best = next->best;
+            mid->text = next->text;
+
+            for (auto& c : node->children)
+                if (c.get() == next)
+                {
+                    next->label.erase(0, common);
+                    mid->children.push_back(std::move(c));
+                    c = std::move(mid);
+                    next = c.get();
+                    break;
+                }
+        }
+
+        node = next;
+        node->count++;
+        node->best = seq;
+        node->text = entry;
+
+        pos += common;
+    }
+}
+
+// entries leave oldest first, so a node whose best entry is erased
+// has nothing else left below it and goes away with it
+void PrefixIndex::erase(std::string_view entry)
+{
+    Node* node = &root;
+    size_t pos = 0;
+
+    node->count--;
+
+    while (pos < entry.size())
+    {
+        Node* next = node->child(entry[pos]);
+
+        if (!next)
+            return;
+
+        if (--next->count == 0)
+        {
+            auto& children = node->children;
+
+            children.erase(std::find_if(children.begin(), children.end(), [next](const auto& c) { return c.get() == next; }));
+
+            return;
+        }
+
+        pos += next->label.size();
+        node = next;
+    }
+}
+
+bool PrefixIndex::find(std::string_view prefix, std::string_view& match) const
+{
+    const Node* node = &root;
+    size_t pos = 0;
+
+    while (pos < prefix.size())
+    {
+        std::string_view rest = prefix.substr(pos);
+        const Node* next = node->child(rest[0]);
+
+        if (!next)
+            return false;
+
+        std::string_view label = next->label;
+
+        // the prefix ends inside this edge, everything below is longer
+        if (label.size() > rest.size())
+        {
+            if (label.compare(0, rest.size(), rest) != 0)
+                return false;
+
+            match = next->text;
+            return true;
+        }
+
+        if (rest.compare(0, label.size(), label) != 0)
+            return false;
+
+        pos += label.size();
+        node = next;
+    }
+
+    // the prefix is a node, skip entries equal to it
+    const Node* best = nullptr;
+
+    for (const auto& c : node->children)
+        if (!best || c->best > best->best)
+            best = c.get();
+
+    if (!best)
+        return false;
+
+    match = best->text;
+    return true;
+}
+
+void History::load(const std::string& file, size_t capacity)
+{
+    path = file;
+    clear();
+    resize(capacity);
+
+    fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd == -1)
+        return;
+
+    size_t skipped;
+
+    flock(fd, LOCK_SH);
+    loaded = read_tail(fd, capacity, &skipped);
+    flock(fd, LOCK_UN);
+
+    size_t start = 0;
+
+    while (start < loaded.size())
+    {
+        size_t end = loaded.find('\n', start);
+
+        if (end == std::string::npos)
+            end = loaded.size();
+
+        if (end > start)
+        {
+            push(std::string_view(loaded).substr(start, end - start));
+            loaded_alive++;
+        }
+
+        start = end + 1;
+    }
+
+    // the part we don't keep outgrew what we do keep
+    if (skipped > loaded.size() && skipped > 64 * 1024)
+        compact();
+}
+
+void History::add(const std::string& entry, size_t capacity)
+{
+    if (capacity != ring.size())
+        resize(capacity);
+
+    if (ring.empty())
+        return;
+
+    if (count == ring.size())
+        evict();
+
+    added.push_back(entry);
+    push(added.back());
+
+    if (fd == -1)
+        return;
+
+    std::string record = entry + '\n';
+
+    flock(fd, LOCK_SH);
+    write_all(fd, record);
+    flock(fd, LOCK_UN);
+
+    if (++appends >= ring.size())
+    {
+        appends = 0;
+        compact();
+    }
+}
+
+void History::resize(size_t capacity)
+{
+    while (count > capacity)
+        evict();
+
+    std::vector<std::string_view> resized(capacity);
+
+    for (size_t i = 0; i < count; i++)
+        resized[i] = (*this)[i];
+
+    ring = std::move(resized);
+    head = 0;
+}
+
+// rewrites the file in place with only its last entries, other shells
+// append with O_APPEND under a shared lock so they never write in between
+void History::compact()
+{
+    if (fd == -1)
+        return;
+
+    flock(fd, LOCK_EX);
+
+    size_t skipped;
+    std::string tail = read_tail(fd, ring.size(), &skipped);
+
+    if (skipped > tail.size() && ftruncate(fd, 0) == 0)
+        write_all(fd, tail);
+
+    flock(fd, LOCK_UN);
+}
+
+void History::clear()
+{
+    while (count > 0)
+        evict();
+}
+
+void History::push(std::string_view entry)
+{
+    ring[(head + count) % ring.size()] = entry;
+    count++;
+
+    index.insert(entry, ++pushed);
+}
+
+void History::evict()
+{
+    index.erase((*this)[0]);
+
+    head = (head + 1) % ring.size();
+    count--;
+
+    // file entries are always older than the ones added since
+    if (loaded_alive > 0)
+    {
+        if (--loaded_alive == 0)
+            std::string().swap(loaded);
+    }
+    else
+        added.pop_front();
+}
@@ -1,32 +1,83 @@
 #include <input.h>
 #include <shell.h>
+#include <io.h>
 
 using namespace std;
 
 bool Input::get()
 {
+    watch_resize();
+    take_resize();
+
     tty_raw();
 
+    // a quick prompt is worth waiting for, a slow one gets repainted
+    sh->poll_prompt(sh->prompt_wait());
+
     data.clear();
     backup.clear();
     suggestion.clear();
 
-    input_anchor = get_cursor();
     cursor = 0;
     selection = false;
     hist_index = -1;
 
-    last_render_size = 0;
-    last_cursor = 0;
+    // a full row of spaces ends on the next row only when something was
+    // left on the current one, either way \r then lands on a clean row
+    string output(get_size().ws_col, ' ');
+    output += "\r\e[K\e[?2004h";
+
+    write_prompt(output);
+
+    cout << flush;
+    write_all(STDOUT_FILENO, output);
 
     int res;
     while ((res = process_key()) > 0);
 
+    write_all(STDOUT_FILENO, "\e[?2004l");
     tty_restore();
 
     return res < 0 ? false : true;
 }
 
+// the line starts where the prompt left off, nothing is asked of the terminal
+void Input::write_prompt(string& output)
+{
+    const string& prompt = sh->prompt_text;
+
+    layout = get_size();
+    output += prompt;
+
+    input_anchor = end_column(prompt, layout.ws_col, prompt_rows);
+
+    if (input_anchor == layout.ws_col)
+    {
+        output += "\r\n";
+        input_anchor = 0;
+        prompt_rows++;
+    }
+
+    screen.clear();
+    screen_pos = input_anchor;
+    wrap_pending = false;
+}
+
+// goes back up to where the prompt started and draws the fresh one with the line
+void Input::repaint_prompt()
+{
+    string output;
+    size_t rows = (wrap_pending ? screen_pos - 1 : screen_pos) / layout.ws_col + prompt_rows;
+
+    if (rows > 0)
+        output += "\e[" + to_string(rows) + "A";
+
+    output += "\r\e[J";
+
+    write_prompt(output);
+    render(move(output));
+}
+
 int Input::process_key()
 {
     int key = get_key();
@@ -39,6 +90,7 @@ int Input::process_key()
         {
         case ENTER:                     enter();                    return 0;
         case TAB:                       autocomplete();             break;
+        case PASTE:                     paste();                    break;
         case BACKSPACE:                 backspace();                break;
         case DELETE:                    delete_();                  break;
 
@@ -75,9 +127,21 @@ int Input::process_key()
     if (selection && cursor == selection_anchor)
         selection = false;
 
+    // a paste without bracketing or fast typing leaves more
+    // keys queued, the work below only matters for the last one
+    if (pending())
+    {
+        generation++;
+        behind = true;
+
+        return 1;
+    }
+
     find_suggestion();
     render();
 
+    behind = false;
+
     return 1;
 }
 
@@ -92,6 +156,44 @@ void Input::insert(int ch)
     cursor++;
 }
 
+// everything between \e[200~ and \e[201~ goes in as one edit,
+// the line is single so line breaks and tabs become spaces
+void Input::paste()
+{
+    const string_view end = "\e[201~";
+    string text;
+
+    while (true)
+    {
+        int c = read_byte();
+
+        if (c == EOF)
+            break;
+
+        text += c;
+
+        if (text.size() >= end.size() && text.compare(text.size() - end.size(), end.size(), end) == 0)
+        {
+            text.resize(text.size() - end.size());
+            break;
+        }
+    }
+
+    for (char& c : text)
+        if (c == '\n' || c == '\r' || c == '\t')
+            c = ' ';
+
+    text.erase(remove_if(text.begin(), text.end(), [](char c) { return !isprint(static_cast<unsigned char>(c)); }), text.end());
+
+    hist_index = -1;
+
+    if (selection)
+        delete_selection();
+
+    data.insert(cursor, text);
+    cursor += text.size();
+}
+
 void Input::backspace()
 {
     hist_index = -1;
@@ -141,6 +243,10 @@ void Input::enter()
 {
     selection = false;
     suggestion.clear();
+    generation++;
+
+    // leave the cursor after the whole line, not inside it
+    cursor = data.size();
 
     render();
 
@@ -149,7 +255,7 @@ void Input::enter()
     sh->add_history(data);
 }
 
-bool starts_with(const string& str, const string& prefix)
+bool starts_with(string_view str, string_view prefix)
 {
     if (prefix.length() > str.length())
         return false;
@@ -157,45 +263,23 @@ bool starts_with(const string& str, const string& prefix)
     return str.compare(0, prefix.length(), prefix) == 0;
 }
 
-vector<string> list_dir(const string& path)
-{
-    vector<string> ret;
-
-    DIR* dir = opendir(path.c_str());
-
-    if (dir != 0)
-    {
-        dirent* entry;
-
-        while ((entry = readdir(dir)) != NULL)
-        {
-            string name = string(entry->d_name);
-
-            if (entry->d_type == DT_DIR)
-                name += '/';
-
-            ret.push_back(name);
-        }
-
-        closedir(dir);
-    }
-
-    return ret;
-}
-
 void Input::find_suggestion()
 {
+    string previous = move(suggestion);
+
+    generation++;
     suggestion.clear();
 
     if (data.empty())
         return;
 
-    for (int i = sh->history.size() - 1; i >= 0; i--)
-        if (starts_with(sh->history[i], data) && sh->history[i] != data)
-        {
-            suggestion = sh->history[i];
-            return;
-        }
+    string_view match;
+
+    if (sh->history.find_prefix(data, match))
+    {
+        suggestion = string(match);
+        return;
+    }
 
     string word = data;
     size_t pos = data.rfind(' ');
@@ -222,6 +306,28 @@ void Input::find_suggestion()
         return;
     }
 
+    if (word.find('/') == string::npos && command_position(data.size() - word.size()))
+    {
+        for (const auto& pair : sh->builtins)
+            if (starts_with(pair.first, word) && (suggestion.empty() || pair.first < suggestion))
+                suggestion = pair.first;
+
+        suggestion_base = data.substr(0, data.size() - word.size());
+
+        if (!suggestion.empty())
+        {
+            suggestion = suggestion_base + suggestion;
+            return;
+        }
+
+        const char* env_path = getenv("PATH");
+
+        if (env_path)
+            request_suggestion(env_path, word, previous, sh->commands.index);
+
+        return;
+    }
+
     string path;
     pos = word.rfind('/');
 
@@ -241,18 +347,57 @@ void Input::find_suggestion()
         }
     }
 
-    vector<string> entries = list_dir(path);
+    suggestion_base = data.substr(0, data.size() - word.size());
 
-    for (const auto& entry : entries)
-        if (starts_with(entry, word))
-        {
-            suggestion = data.substr(0, data.size() - word.size()) + entry;
-            return;
-        }
+    request_suggestion(path, word, previous);
+}
+
+// touching the filesystem can hang, so it happens on the suggester thread
+// until it answers, the old suggestion stays if it still fits
+void Input::request_suggestion(const string& path, const string& word, const string& previous, shared_ptr<ExecIndex> index)
+{
+    suggester.post(generation, path, word, index);
+
+    string entry;
+
+    if (suggester.wait(generation, suggest_wait(), entry))
+        suggestion = entry.empty() ? "" : suggestion_base + entry;
+    else if (starts_with(previous, data) && previous.size() > data.size())
+        suggestion = previous;
+}
+
+// whether a word starting at pos is the name of a command
+bool Input::command_position(size_t pos)
+{
+    while (pos > 0 && isspace(data[pos - 1]))
+        pos--;
+
+    return pos == 0 || string("|;&(").find(data[pos - 1]) != string::npos;
+}
+
+int Input::suggest_wait()
+{
+    return sh->vars.get_number("suggest_wait", 10);
+}
+
+void Input::take_suggestion()
+{
+    uint64_t gen;
+    string entry;
+
+    if (!suggester.take(gen, entry) || gen != generation)
+        return;
+
+    suggestion = entry.empty() ? "" : suggestion_base + entry;
+
+    render();
 }
 
 void Input::autocomplete()
 {
+    if (behind)
+        find_suggestion();
+
     if (suggestion.empty())
         return;
 
@@ -382,56 +527,193 @@ void Input::select_all()
     cursor = data.size();
 }
 
-void Input::render()
+enum Style
 {
-    int render_size = suggestion.size() > data.size() ? suggestion.size() : data.size();
-    int output_size = render_size;
+    NORMAL = 0,
+    SELECTED,
+    SUGGESTED
+};
 
-    string output = "\e[0m" + data;
+const char* style_codes[] = { "\e[0m", "\e[0;44;96m", "\e[0;38;5;240m" };
 
-    if (selection)
+// moves the terminal cursor to a cell counted from the start of the
+// row the line begins on, relative moves only so the absolute position
+// is never needed, going down by newline also scrolls when at the bottom
+void Input::move_to(size_t target, string& output)
+{
+    size_t cols = layout.ws_col;
+
+    // while a wrap is pending the cursor is still on the row it filled
+    size_t row = (wrap_pending ? screen_pos - 1 : screen_pos) / cols;
+    size_t target_row = target / cols;
+
+    if (target_row > row)
+        output += string(target_row - row, '\n');
+    else if (target_row < row)
+        output += "\e[" + to_string(row - target_row) + "A";
+
+    output += "\e[" + to_string(target % cols + 1) + "G";
+
+    screen_pos = target;
+    wrap_pending = false;
+}
+
+// the terminal keeps the cursor on its row across a resize, so going
+// up by the rows the line took leads back to where it started,
+// from there the old frame is cleared and the line laid out again
+void Input::relayout(const winsize& size, string& output)
+{
+    size_t row = (wrap_pending ? screen_pos - 1 : screen_pos) / layout.ws_col;
+
+    if (row > 0)
+        output += "\e[" + to_string(row) + "A";
+
+    if (input_anchor >= size.ws_col)
+        input_anchor = size.ws_col - 1;
+
+    output += "\e[" + to_string(input_anchor + 1) + "G\e[J";
+
+    layout = size;
+    screen_pos = input_anchor;
+    wrap_pending = false;
+
+    screen.clear();
+}
+
+// redraws only the cells that changed since the last call
+// and sends everything to the terminal in a single write
+void Input::render(string output)
+{
+    vector<Cell> cells;
+    cells.reserve(suggestion.size() > data.size() ? suggestion.size() : data.size());
+
+    size_t sel_start = cursor < selection_anchor ? cursor : selection_anchor;
+    size_t sel_end = cursor > selection_anchor ? cursor : selection_anchor;
+
+    for (size_t i = 0; i < data.size(); i++)
+        cells.push_back({ data[i], selection && i >= sel_start && i < sel_end ? SELECTED : NORMAL });
+
+    for (size_t i = data.size(); i < suggestion.size(); i++)
+        cells.push_back({ suggestion[i], SUGGESTED });
+
+    const winsize& size = get_size();
+
+    if (size.ws_col != layout.ws_col || size.ws_row != layout.ws_row)
+        relayout(size, output);
+
+    size_t extent = cells.size() > screen.size() ? cells.size() : screen.size();
+    int style = -1;
+
+    for (size_t i = 0; i < extent; i++)
     {
-        size_t sel_start = cursor < selection_anchor ? cursor : selection_anchor;
-        size_t sel_end = cursor > selection_anchor ? cursor : selection_anchor;
+        Cell want = i < cells.size() ? cells[i] : Cell{ ' ', NORMAL };
+        Cell have = i < screen.size() ? screen[i] : Cell{ ' ', NORMAL };
+
+        if (want == have)
+            continue;
 
-        output = "\e[0m" + data.substr(0, sel_start);
-        output += "\e[44;96m" + data.substr(sel_start, sel_end - sel_start);
-        output += "\e[0m" + data.substr(sel_end);
+        if (screen_pos != input_anchor + i)
+            move_to(input_anchor + i, output);
+
+        if (want.style != style)
+        {
+            output += style_codes[static_cast<int>(want.style)];
+            style = want.style;
+        }
+
+        output += want.ch;
+
+        // after the last column the terminal holds the cursor
+        // back until the next character
+        screen_pos++;
+        wrap_pending = screen_pos % layout.ws_col == 0;
     }
 
-    if (!suggestion.empty())
-        output += "\e[0m\e[38;5;240m" + suggestion.substr(data.size());
+    if (style > NORMAL)
+        output += style_codes[NORMAL];
 
-    if (last_render_size > render_size)
+    if (screen_pos != input_anchor + cursor || wrap_pending)
+        move_to(input_anchor + cursor, output);
+
+    screen = move(cells);
+
+    write_all(STDOUT_FILENO, output);
+}
+
+// waits for a byte from stdin, repainting when a late suggestion
+// or the prompt comes in or the window is resized meanwhile
+int Input::read_byte()
+{
+    while (in_pos == in_len)
     {
-        output += "\e[0m" + string(last_render_size - render_size, ' ');
-        output_size = last_render_size;
-    }
-    else if (suggestion.empty())
-        output += " ";
+        const Substitution& job = sh->prompt_job;
+
+        pollfd fds[6] = {
+            { STDIN_FILENO, POLLIN, 0 },
+            { resize_fd(), POLLIN, 0 },
+            { suggester.fd(), POLLIN, 0 },
+            { job.out, POLLIN, 0 },
+            { job.err, POLLIN, 0 },
+            { children_fd(), POLLIN, 0 }
+        };
+
+        if (poll(fds, 6, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return EOF;
+        }
+
+        if ((fds[1].revents & POLLIN) && take_resize())
+            render();
+
+        if (fds[2].revents & POLLIN)
+            take_suggestion();
+
+        if ((fds[3].revents || fds[4].revents) && sh->poll_prompt(0))
+            repaint_prompt();
+
+        // background jobs are reaped as they end, reported at the next prompt
+        if ((fds[5].revents & POLLIN) && take_children())
+            sh->jobs.reap();
+
+        if (fds[0].revents)
+        {
+            ssize_t len = read(STDIN_FILENO, in_buffer, sizeof(in_buffer));
 
-    // for some reason when the cursor is at the end of the line
-    // it prints the character but doesn't move to next line
-    // even though set_cursor has the correct value
-    // so print a space in order to move it
+            if (len == -1 && errno == EINTR)
+                continue;
 
-    set_cursor(input_anchor);
+            if (len <= 0)
+                return EOF;
 
-    cout << output << flush;
+            in_pos = 0;
+            in_len = len;
+        }
+    }
+
+    return static_cast<unsigned char>(in_buffer[in_pos++]);
+}
+
+// whether another key is already waiting, buffered or not
+bool Input::pending()
+{
+    if (in_pos < in_len)
+        return true;
 
-    ajust_for_scroll(&input_anchor, output_size - (suggestion.empty() ? 0 : 1));
-    set_cursor(input_anchor + cursor);
+    pollfd fd = { STDIN_FILENO, POLLIN, 0 };
 
-    last_render_size = render_size;
-    last_cursor = cursor;
+    return poll(&fd, 1, 0) > 0;
 }
 
 int Input::get_key()
 {
-    int c = getchar();
+    int c = read_byte();
 
     if (c == EOF)
     {
+        write_all(STDOUT_FILENO, "\e[?2004l");
         tty_restore();
         exit(2);
     }
@@ -440,19 +722,27 @@ int Input::get_key()
     {
         char seq[5];
 
-        if ((seq[0] = getchar()) == -1)     return '\e';
+        if ((seq[0] = read_byte()) == -1)   return '\e';
         if (seq[0] != '[')                  return seq[0];
-        if ((seq[1] = getchar()) == -1)     return '\e';
+        if ((seq[1] = read_byte()) == -1)   return '\e';
 
         if (isdigit(seq[1]))
         {
-            if ((seq[2] = getchar()) == -1)     return '\e';
+            if ((seq[2] = read_byte()) == -1)   return '\e';
             if (seq[2] == '~' && seq[1] == '3') return DELETE;
 
+            if (seq[1] == '2' && seq[2] == '0')
+            {
+                if ((seq[3] = read_byte()) == -1)  return '\e';
+                if ((seq[4] = read_byte()) == -1)  return '\e';
+
+                if (seq[3] == '0' && seq[4] == '~') return PASTE;
+            }
+
             if (seq[1] == '1')
             {
-                if ((seq[3] = getchar()) == -1)  return '\e';
-                if ((seq[4] = getchar()) == -1)  return '\e';
+                if ((seq[3] = read_byte()) == -1)  return '\e';
+                if ((seq[4] = read_byte()) == -1)  return '\e';
 
                 switch (seq[2])
                 {
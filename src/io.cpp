@@ -0,0 +1,25 @@
+#include <io.h>
+#include <unistd.h>
+#include <cerrno>
+
+// a short write only means the rest is still to go,
+// and a signal arriving mid-write is not a failure
+bool write_all(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        ssize_t written = write(fd, data.data(), data.size());
+
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        data.remove_prefix(written);
+    }
+
+    return true;
+}
@@ -0,0 +1,324 @@
+#include <jobs.h>
+#include <wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+using namespace std;
+
+static int children_pipe[2] = { -1, -1 };
+
+// adds a stage, one that failed to start counts as failed right away
+void Job::start(pid_t pid)
+{
+    pids.push_back(pid);
+    statuses.push_back(pid == -1 ? W_EXITCODE(EXIT_FAILURE, 0) : -1);
+
+    if (pid != -1)
+        left++;
+    else
+        status = statuses.back();
+}
+
+// ids continue from the highest one in use, like other shells
+Job& Jobs::add(Job job)
+{
+    if (!job.id)
+    {
+        job.id = 1;
+
+        for (const Job& other : list)
+            if (other.id >= job.id)
+                job.id = other.id + 1;
+    }
+
+    job.seq = ++seq;
+
+    for (size_t i = 0; i < job.pids.size(); i++)
+        if (job.statuses[i] == -1)
+            owners[job.pids[i]] = { job.id, i };
+
+    auto it = lower_bound(list.begin(), list.end(), job.id, [](const Job& other, int id) { return other.id < id; });
+
+    return *list.insert(it, move(job));
+}
+
+void Jobs::remove(int id)
+{
+    Job* job = get(id);
+
+    if (!job)
+        return;
+
+    for (size_t i = 0; i < job->pids.size(); i++)
+        if (job->statuses[i] == -1)
+            owners.erase(job->pids[i]);
+
+    list.erase(list.begin() + (job - list.data()));
+}
+
+void Jobs::touch(Job& job)
+{
+    job.seq = ++seq;
+}
+
+Job* Jobs::get(int id)
+{
+    auto it = lower_bound(list.begin(), list.end(), id, [](const Job& other, int id) { return other.id < id; });
+
+    return it != list.end() && it->id == id ? &*it : nullptr;
+}
+
+// %n, %+ or %% or %, %- and %prefix like other shells, or a pid
+Job* Jobs::find(const string& spec)
+{
+    if (spec.empty() || spec == "%" || spec == "%%" || spec == "%+")
+        return current();
+
+    if (spec == "%-")
+        return previous();
+
+    bool number = spec.find_first_not_of("0123456789", spec[0] == '%') == string::npos;
+
+    if (number && spec[0] == '%')
+        return get(atoi(spec.c_str() + 1));
+
+    if (number)
+    {
+        pid_t pid = atoi(spec.c_str());
+        auto owner = owners.find(pid);
+
+        if (owner != owners.end())
+            return get(owner->second.first);
+
+        // a group leader or a process that is done already
+        for (Job& job : list)
+            if (job.pgid == pid || std::find(job.pids.begin(), job.pids.end(), pid) != job.pids.end())
+                return &job;
+
+        return nullptr;
+    }
+
+    // %name matches the start of a command, anything else the whole of it
+    for (Job& job : list)
+        if (spec[0] == '%' ? job.command.compare(0, spec.size() - 1, spec, 1) == 0 : job.command == spec)
+            return &job;
+
+    return nullptr;
+}
+
+Job* Jobs::current()
+{
+    Job* best = nullptr;
+
+    for (Job& job : list)
+        if (!best || job.seq > best->seq)
+            best = &job;
+
+    return best;
+}
+
+Job* Jobs::previous()
+{
+    Job* first = current();
+    Job* best = nullptr;
+
+    for (Job& job : list)
+        if (&job != first && (!best || job.seq > best->seq))
+            best = &job;
+
+    return best;
+}
+
+char Jobs::mark(const Job& job)
+{
+    if (&job == current())
+        return '+';
+
+    if (&job == previous())
+        return '-';
+
+    return ' ';
+}
+
+// applies what waitpid said about one stage of the job
+void Jobs::update(Job& job, size_t stage, int status)
+{
+    if (WIFSTOPPED(status))
+    {
+        if (job.state != Job::STOPPED)
+            job.notified = false;
+
+        job.state = Job::STOPPED;
+        return;
+    }
+
+    if (WIFCONTINUED(status))
+    {
+        job.state = Job::RUNNING;
+        return;
+    }
+
+    if (job.statuses[stage] != -1)
+        return;
+
+    job.statuses[stage] = status;
+    owners.erase(job.pids[stage]);
+
+    if (stage == job.pids.size() - 1)
+        job.status = status;
+
+    if (--job.left == 0)
+    {
+        job.state = Job::DONE;
+        job.notified = false;
+    }
+}
+
+// hands a change to the job the child belongs to, if any
+void Jobs::file(pid_t pid, int status)
+{
+    auto owner = owners.find(pid);
+
+    if (owner == owners.end())
+    {
+        unclaimed[pid] = status;
+        return;
+    }
+
+    Job* job = get(owner->second.first);
+
+    if (job)
+        update(*job, owner->second.second, status);
+    else
+        owners.erase(owner);
+}
+
+// takes every change that is ready without blocking
+void Jobs::reap()
+{
+    int status;
+    pid_t pid;
+
+    while ((pid = next_child(false, status)) > 0)
+        file(pid, status);
+}
+
+// blocks until a child outside the jobs ends, filing what others do meanwhile
+int Jobs::wait_child(pid_t pid)
+{
+    auto it = unclaimed.find(pid);
+
+    if (it != unclaimed.end() && !WIFSTOPPED(it->second) && !WIFCONTINUED(it->second))
+    {
+        int status = it->second;
+
+        unclaimed.erase(it);
+        return status;
+    }
+
+    unclaimed.erase(pid);
+
+    while (true)
+    {
+        int status;
+        pid_t got = next_child(true, status);
+
+        // nothing left to wait for, someone else got it
+        if (got == -1)
+            return 0;
+
+        if (got != pid)
+        {
+            file(got, status);
+            continue;
+        }
+
+        // it shares the shell's group and so its ^Z, there is no job to resume
+        if (WIFSTOPPED(status))
+            kill(pid, SIGCONT);
+        else if (!WIFCONTINUED(status))
+            return status;
+    }
+}
+
+// any child's next change, -1 when there are no children and 0 when
+// none is ready without blocking
+pid_t next_child(bool block, int& status)
+{
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, (block ? 0 : WNOHANG) | WUNTRACED | WCONTINUED)) == -1 && errno == EINTR);
+
+    return pid;
+}
+
+int exit_code(int status)
+{
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+string describe(const Job& job)
+{
+    if (job.state == Job::RUNNING)
+        return "Running";
+
+    if (job.state == Job::STOPPED)
+        return "Stopped";
+
+    if (WIFSIGNALED(job.status))
+        return strsignal(WTERMSIG(job.status));
+
+    if (WEXITSTATUS(job.status) != 0)
+        return "Exit " + to_string(WEXITSTATUS(job.status));
+
+    return "Done";
+}
+
+static void on_child(int)
+{
+    int saved = errno;
+
+    if (write(children_pipe[1], "", 1) == -1) {}
+
+    errno = saved;
+}
+
+// SIGCHLD only wakes whoever polls the pipe, reaping happens outside the handler
+void watch_children()
+{
+    if (children_pipe[0] != -1)
+        return;
+
+    if (pipe2(children_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+    {
+        perror("watch_children: pipe");
+        return;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = on_child;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGCHLD, &action, nullptr);
+}
+
+int children_fd()
+{
+    return children_pipe[0];
+}
+
+// empties the pipe, true when a child changed state since the last call
+bool take_children()
+{
+    char buf[64];
+    bool changed = false;
+
+    while (children_pipe[0] != -1 && read(children_pipe[0], buf, sizeof(buf)) > 0)
+        changed = true;
+
+    return changed;
+}
@@ -1,38 +1,134 @@
 #include <parser.h>
+#include <cstring>
 
 using namespace std;
 
-void AST::print(int tabs)
+Arena::Arena()
 {
+    // node 0 is the null node
+    nodes.emplace_back(AST::COMMAND, "");
+}
+
+AST_id Arena::make(AST::NodeType type, string_view data)
+{
+    nodes.emplace_back(type, data);
+
+    return nodes.size() - 1;
+}
+
+void Arena::append(AST_id parent, AST_id child)
+{
+    AST& p = nodes[parent];
+
+    if (p.last)
+        nodes[p.last].next = child;
+    else
+        p.first = child;
+
+    p.last = child;
+    p.count++;
+}
+
+void Arena::clear_children(AST_id parent)
+{
+    nodes[parent].first = 0;
+    nodes[parent].last = 0;
+    nodes[parent].count = 0;
+}
+
+void* Arena::alloc(size_t size, size_t align)
+{
+    while (block < blocks.size())
+    {
+        size_t start = (used + align - 1) & ~(align - 1);
+
+        if (start + size <= blocks[block].size)
+        {
+            used = start + size;
+            return blocks[block].data.get() + start;
+        }
+
+        block++;
+        used = 0;
+    }
+
+    size_t block_size = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+
+    blocks.push_back({ make_unique<char[]>(block_size), block_size });
+
+    block = blocks.size() - 1;
+    used = size;
+
+    return blocks[block].data.get();
+}
+
+string_view Arena::store(string_view str)
+{
+    if (str.empty())
+        return "";
+
+    char* dest = static_cast<char*>(alloc(str.size()));
+    memcpy(dest, str.data(), str.size());
+
+    return string_view(dest, str.size());
+}
+
+const char* Arena::c_str(string_view str)
+{
+    char* dest = static_cast<char*>(alloc(str.size() + 1));
+    memcpy(dest, str.data(), str.size());
+    dest[str.size()] = '\0';
+
+    return dest;
+}
+
+void Arena::reset()
+{
+    nodes.erase(nodes.begin() + 1, nodes.end());
+
+    // keep the regular blocks around, oversized ones were a one off
+    blocks.erase(remove_if(blocks.begin(), blocks.end(), [](const Block& b) { return b.size > BLOCK_SIZE; }), blocks.end());
+
+    block = 0;
+    used = 0;
+}
+
+void Arena::print(AST_id id, int tabs)
+{
+    const AST& node = nodes[id];
+
     for (int i = 0; i < tabs; i++)
         printf("    ");
 
-    switch (type)
+    switch (node.type)
     {
-    case COMMAND:       printf("com");          break;
-    case REGULAR:       printf("reg");          break;
-    case SQ_STRING:     printf("sq");           break;
-    case SUBCOMMAND:    printf("subcom");       break;
-    case VAR:           printf("var");          break;
-    case TILDE:         printf("tilde");        break;
-    case ESCAPE:        printf("esc");          break;
-    case WORD:          printf("word");         break;
-    case PIPE:          printf("pipe");         break;
-    case LOGICAL:       printf("logic");        break;
-    case COMMA:         printf("comma");        break;
+    case AST::COMMAND:      printf("com");          break;
+    case AST::REGULAR:      printf("reg");          break;
+    case AST::SQ_STRING:    printf("sq");           break;
+    case AST::SUBCOMMAND:   printf("subcom");       break;
+    case AST::VAR:          printf("var");          break;
+    case AST::TILDE:        printf("tilde");        break;
+    case AST::ESCAPE:       printf("esc");          break;
+    case AST::WORD:         printf("word");         break;
+    case AST::PIPE:         printf("pipe");         break;
+    case AST::LOGICAL:      printf("logic");        break;
+    case AST::COMMA:        printf("comma");        break;
+    case AST::BACKGROUND:   printf("bg");           break;
+    case AST::REDIRECT:     printf("redirect");     break;
+    case AST::GLOB:         printf("glob");         break;
     }
 
-    printf(": \"%s\"\n", data.c_str());
+    printf(": \"%.*s\"\n", static_cast<int>(node.data.size()), node.data.data());
 
-    if (!children.empty())
+    if (node.first)
     {
         for (int i = 0; i < tabs; i++)
             printf("    ");
 
         printf("{\n");
 
-        for (const auto& child : children)
-            child->print(tabs + 1);
+        for (AST_id child = node.first; child; child = nodes[child].next)
+            print(child, tabs + 1);
 
         for (int i = 0; i < tabs; i++)
             printf("    ");
@@ -41,9 +137,9 @@ void AST::print(int tabs)
     }
 }
 
-AST_ptr parse_shell_input(string& input)
+AST_id parse_shell_input(Arena& arena, string_view& input)
 {
-    AST_ptr ret = parse_command_list(input);
+    AST_id ret = parse_command_list(arena, input);
 
     if (!input.empty() && input.front() == ')')
         throw runtime_error("expected ( before subcommand");
@@ -51,28 +147,79 @@ AST_ptr parse_shell_input(string& input)
     return ret;
 }
 
-AST_ptr parse_command_list(string& input)
+AST_id parse_command_list(Arena& arena, string_view& input)
 {
-    AST_ptr ret = parse_command_logical(input);
+    string_view start = input;
+    AST_id item = parse_command_logical(arena, input);
+    AST_id ret = item;
+
+    // the comma holding item, so a & after it can wrap it in place
+    AST_id parent = 0;
 
     while (true)
     {
-        AST_ptr sep = parse_comma(input);
+        AST_id bg = parse_background(arena, input);
+
+        if (bg)
+        {
+            if (!item)
+                throw runtime_error("expected command before &");
+
+            // the job is shown by the text it was started with
+            string_view text = start.substr(0, start.size() - input.size() - 1);
+
+            while (!text.empty() && isspace(text.back()))
+                text.remove_suffix(1);
+
+            while (!text.empty() && isspace(text.front()))
+                text.remove_prefix(1);
+
+            arena[bg].data = text;
+            arena.append(bg, item);
+
+            if (parent)
+            {
+                arena[arena[parent].first].next = bg;
+                arena[parent].last = bg;
+            }
+            else
+                ret = bg;
+
+            // unlike ; a & may end the list
+            start = input;
+            item = parse_command_logical(arena, input);
+
+            if (item)
+            {
+                parent = arena.make(AST::COMMA, ";");
+
+                arena.append(parent, ret);
+                arena.append(parent, item);
+
+                ret = parent;
+            }
+
+            continue;
+        }
+
+        AST_id sep = parse_comma(arena, input);
 
         if (sep)
         {
-            if (!ret)
+            if (!item)
                 throw runtime_error("expected command before ;");
 
-            AST_ptr com = parse_command_logical(input);
+            start = input;
+            item = parse_command_logical(arena, input);
 
-            if (!com)
+            if (!item)
                 throw runtime_error("expected command after ;");
 
-            sep->children.push_back(move(ret));
-            sep->children.push_back(move(com));
+            arena.append(sep, ret);
+            arena.append(sep, item);
 
-            ret = move(sep);
+            ret = sep;
+            parent = sep;
         }
         else
             break;
@@ -81,28 +228,28 @@ AST_ptr parse_command_list(string& input)
     return ret;
 }
 
-AST_ptr parse_command_logical(string& input)
+AST_id parse_command_logical(Arena& arena, string_view& input)
 {
-    AST_ptr ret = parse_command_pipe(input);
+    AST_id ret = parse_command_pipe(arena, input);
 
     while (true)
     {
-        AST_ptr sep = parse_logic(input);
+        AST_id sep = parse_logic(arena, input);
 
         if (sep)
         {
             if (!ret)
-                throw runtime_error("expected command before " + sep->data);
+                throw runtime_error("expected command before " + string(arena[sep].data));
 
-            AST_ptr com = parse_command_pipe(input);
+            AST_id com = parse_command_pipe(arena, input);
 
             if (!com)
-                throw runtime_error("expected command after " + sep->data);
+                throw runtime_error("expected command after " + string(arena[sep].data));
 
-            sep->children.push_back(move(ret));
-            sep->children.push_back(move(com));
+            arena.append(sep, ret);
+            arena.append(sep, com);
 
-            ret = move(sep);
+            ret = sep;
         }
         else
             break;
@@ -111,32 +258,32 @@ AST_ptr parse_command_logical(string& input)
     return ret;
 }
 
-AST_ptr parse_command_pipe(string& input)
+AST_id parse_command_pipe(Arena& arena, string_view& input)
 {
-    AST_ptr ret = parse_command(input);
+    AST_id ret = parse_command(arena, input);
 
     while (true)
     {
-        AST_ptr sep = parse_pipe(input);
+        AST_id sep = parse_pipe(arena, input);
 
         if (sep)
         {
             if (!ret)
                 throw runtime_error("expected command before |");
 
-            AST_ptr com = parse_command(input);
+            AST_id com = parse_command(arena, input);
 
             if (!com)
                 throw runtime_error("expected command after |");
 
-            if (ret->type == AST::PIPE)
-                ret->children.push_back(move(com));
+            if (arena[ret].type == AST::PIPE)
+                arena.append(ret, com);
             else
             {
-                sep->children.push_back(move(ret));
-                sep->children.push_back(move(com));
+                arena.append(sep, ret);
+                arena.append(sep, com);
 
-                ret = move(sep);
+                ret = sep;
             }
         }
         else
@@ -146,247 +293,326 @@ AST_ptr parse_command_pipe(string& input)
     return ret;
 }
 
-void trim_left(string& input)
+void trim_left(string_view& input)
 {
-    while (!input.empty() && isspace(input.front()))
-        input.erase(input.begin());
+    size_t n = 0;
+
+    while (n < input.size() && isspace(input[n]))
+        n++;
+
+    input.remove_prefix(n);
 }
 
-AST_ptr parse_command(string& input)
+// length of a redirection like <, >>, 2>, &> or 2>&1 at the start of input, 0 if there is none
+static size_t redirect_size(string_view input)
 {
-    vector<AST_ptr> children;
+    size_t n = 0;
+
+    if (input.starts_with("&>"))
+        n = 2;
+    else
+    {
+        while (n < input.size() && isdigit(input[n]))
+            n++;
+
+        if (n == input.size() || (input[n] != '<' && input[n] != '>'))
+            return 0;
+
+        n++;
+    }
+
+    if (input[n - 1] == '>' && n < input.size() && input[n] == '>')
+        n++;
+    else if (input[0] != '&' && n < input.size() && input[n] == '&')
+    {
+        n++;
+
+        while (n < input.size() && isdigit(input[n]))
+            n++;
+    }
+
+    return n;
+}
+
+AST_id parse_command(Arena& arena, string_view& input)
+{
+    AST_id command = 0;
+
+    // the command wrapped in its redirections, the first one innermost
+    AST_id ret = 0;
 
     trim_left(input);
 
     while (!input.empty())
     {
-        AST_ptr child = parse_word(input);
+        if (redirect_size(input))
+        {
+            if (!command)
+                ret = command = arena.make(AST::COMMAND);
+
+            ret = parse_redirect(arena, input, ret);
+
+            trim_left(input);
+            continue;
+        }
+
+        AST_id child = parse_word(arena, input);
 
         if (!child)
             break;
 
-        children.push_back(move(child));
+        if (!command)
+            ret = command = arena.make(AST::COMMAND);
+
+        arena.append(command, child);
 
         trim_left(input);
     }
 
-    if (children.empty())
-        return nullptr;
-
-    return make_unique<AST>(AST::COMMAND, "", move(children));
+    return ret;
 }
 
-AST_ptr parse_word(string& input)
+AST_id parse_redirect(Arena& arena, string_view& input, AST_id inner)
 {
-    vector<AST_ptr> children;
+    size_t n = redirect_size(input);
+
+    if (n == 0)
+        return 0;
+
+    string_view op = input.substr(0, n);
+    AST_id redirect = arena.make(AST::REDIRECT, op);
 
-    AST_ptr a = nullptr;
+    arena.append(redirect, inner);
+    input.remove_prefix(n);
+
+    if (op.back() == '&')
+        throw runtime_error("expected fd after " + string(op));
+
+    // a dup like 2>&1 names no file
+    if (op.find('&', 1) != string_view::npos)
+        return redirect;
+
+    trim_left(input);
+
+    AST_id target = parse_word(arena, input);
+
+    if (!target)
+        throw runtime_error("expected file after " + string(op));
+
+    arena.append(redirect, target);
+
+    return redirect;
+}
+
+AST_id parse_word(Arena& arena, string_view& input)
+{
+    AST_id word = 0;
+    AST_id a = 0;
 
     while (true)
     {
-        a = parse_regular(input);
+        a = parse_regular(arena, input);
 
         if (!a)
-            a = parse_subcommand(input);
+            a = parse_subcommand(arena, input);
 
         if (!a)
-            a = parse_sq_string(input);
+            a = parse_sq_string(arena, input);
 
         if (!a)
-            a = parse_var(input);
+            a = parse_var(arena, input);
 
         if (!a)
-            a = parse_tilde(input);
+            a = parse_tilde(arena, input);
 
         if (!a)
-            a = parse_escape(input);
+            a = parse_escape(arena, input);
 
         if (!a)
             break;
 
-        children.push_back(move(a));
-    }
+        if (!word)
+            word = arena.make(AST::WORD);
 
-    if (children.empty())
-        return nullptr;
+        arena.append(word, a);
+    }
 
-    return make_unique<AST>(AST::WORD, "", move(children));
+    return word;
 }
 
-AST_ptr parse_regular(string& input)
+AST_id parse_regular(Arena& arena, string_view& input)
 {
-    AST_ptr  regular = nullptr;
+    size_t n = 0;
 
-    while (!input.empty())
+    while (n < input.size())
     {
-        if (isspace(input.front()) || string(";|&()\'~$\\#").find(input.front()) != string::npos)
+        if (isspace(input[n]) || string_view(";|&()<>\'~$\\#").find(input[n]) != string_view::npos)
             break;
 
-        if (!regular)
-            regular = make_unique<AST>(AST::REGULAR, "");
+        n++;
+    }
 
-        regular->data += input.front();
+    if (n == 0)
+        return 0;
 
-        input.erase(input.begin());
-    }
+    AST_id regular = arena.make(AST::REGULAR, input.substr(0, n));
+
+    input.remove_prefix(n);
 
     return regular;
 }
 
-AST_ptr parse_subcommand(string& input)
+AST_id parse_subcommand(Arena& arena, string_view& input)
 {
-    if (input.front() != '(')
-        return nullptr;
-
-    // string sub = input.substr(1);
-    // int len = sub.size();
-
-    // AST_ptr subcom = parse_command_list(sub);
-
-    // if (sub.empty() || sub.front() != ')')
-    //     throw runtime_error("expected ) after subcommand");
-
-    // string res = input.substr(1, len - sub.size());
-    // input = input.substr(2 + res.size());
+    if (input.empty() || input.front() != '(')
+        return 0;
 
-    // return make_unique<AST>(AST::SUBCOMMAND, res);
+    input.remove_prefix(1);
+    string_view res = input;
 
-    input.erase(input.begin());
-    string res = input;
-
-    AST_ptr subcom = parse_command_list(input);
+    AST_id tree = parse_command_list(arena, input);
 
     if (input.empty() || input.front() != ')')
         throw runtime_error("expected ) after subcommand");
 
-    res.resize(res.size() - input.size());
+    res = res.substr(0, res.size() - input.size());
+
+    input.remove_prefix(1);
 
-    input.erase(input.begin());
+    // the parsed tree is kept as the only child, () has none
+    AST_id subcom = arena.make(AST::SUBCOMMAND, res);
 
-    return make_unique<AST>(AST::SUBCOMMAND, res);
+    if (tree)
+        arena.append(subcom, tree);
+
+    return subcom;
 }
 
-AST_ptr parse_sq_string(string& input)
+AST_id parse_sq_string(Arena& arena, string_view& input)
 {
-    if (input.front() != '\'')
-        return nullptr;
+    if (input.empty() || input.front() != '\'')
+        return 0;
 
-    input.erase(input.begin());
+    input.remove_prefix(1);
 
-    AST_ptr sq = make_unique<AST>(AST::SQ_STRING, "");
+    size_t end = input.find('\'');
 
-    while (true)
+    if (end == string_view::npos)
     {
-        if (input.empty())
-            throw runtime_error("expected '");
-
-        if (input.front() == '\'')
-            break;
-
-        sq->data += input.front();
-
-        input.erase(input.begin());
+        input.remove_prefix(input.size());
+        throw runtime_error("expected '");
     }
 
-    input.erase(input.begin());
+    AST_id sq = arena.make(AST::SQ_STRING, input.substr(0, end));
+
+    input.remove_prefix(end + 1);
 
     return sq;
 }
 
-AST_ptr parse_var(string& input)
+AST_id parse_var(Arena& arena, string_view& input)
 {
-    if (input.front() != '$')
-        return nullptr;
-
-    input.erase(input.begin());
+    if (input.empty() || input.front() != '$')
+        return 0;
 
-    AST_ptr var = nullptr;
+    input.remove_prefix(1);
 
-    while (!input.empty())
-    {
-        if (!isalnum(input.front()) && input.front() != '_')
-            break;
+    size_t n = 0;
 
-        if (!var)
-            var = make_unique<AST>(AST::VAR, "");
+    while (n < input.size() && (isalnum(input[n]) || input[n] == '_'))
+        n++;
 
-        var->data += input.front();
+    if (n == 0)
+        throw runtime_error("expected variable name after $");
 
-        input.erase(input.begin());
-    }
+    AST_id var = arena.make(AST::VAR, input.substr(0, n));
 
-    if (!var)
-        throw runtime_error("expected variable name after $");
+    input.remove_prefix(n);
 
     return var;
 }
 
-AST_ptr parse_tilde(string& input)
+AST_id parse_tilde(Arena& arena, string_view& input)
 {
-    if (input.front() != '~')
-        return nullptr;
+    if (input.empty() || input.front() != '~')
+        return 0;
 
-    input.erase(input.begin());
+    input.remove_prefix(1);
 
-    return make_unique<AST>(AST::TILDE, "~");
+    return arena.make(AST::TILDE, "~");
 }
 
-AST_ptr parse_escape(string& input)
+AST_id parse_escape(Arena& arena, string_view& input)
 {
-    if (input.front() != '\\')
-        return nullptr;
+    if (input.empty() || input.front() != '\\')
+        return 0;
 
-    input.erase(input.begin());
+    input.remove_prefix(1);
 
     if (input.empty())
         throw runtime_error("expected character after \\");
 
-    char esc = input[0];
+    AST_id esc = arena.make(AST::ESCAPE, input.substr(0, 1));
 
-    input.erase(input.begin());
+    input.remove_prefix(1);
 
-    return make_unique<AST>(AST::ESCAPE, string(1, esc));
+    return esc;
 }
 
-AST_ptr parse_comma(string& input)
+AST_id parse_comma(Arena& arena, string_view& input)
 {
     if (input.size() > 0 && input.front() == ';')
     {
-        input = input.substr(1);
-        return make_unique<AST>(AST::COMMA, ";");
+        input.remove_prefix(1);
+        return arena.make(AST::COMMA, ";");
     }
 
-    return nullptr;
+    return 0;
 }
 
-AST_ptr parse_logic(string& input)
+AST_id parse_background(Arena& arena, string_view& input)
+{
+    if (input.size() > 0 && input[0] == '&')
+    {
+        if (input.size() > 1 && input[1] == '&')
+            return 0;
+
+        input.remove_prefix(1);
+
+        return arena.make(AST::BACKGROUND, "&");
+    }
+
+    return 0;
+}
+
+AST_id parse_logic(Arena& arena, string_view& input)
 {
     if (input.size() > 1 && input[0] == '&' && input[1] == '&')
     {
-        input = input.substr(2);
-        return make_unique<AST>(AST::LOGICAL, "&&");
+        input.remove_prefix(2);
+        return arena.make(AST::LOGICAL, "&&");
     }
 
     if (input.size() > 1 && input[0] == '|' && input[1] == '|')
     {
-        input = input.substr(2);
-        return make_unique<AST>(AST::LOGICAL, "||");
+        input.remove_prefix(2);
+        return arena.make(AST::LOGICAL, "||");
     }
 
-    return nullptr;
+    return 0;
 }
 
-AST_ptr parse_pipe(string& input)
+AST_id parse_pipe(Arena& arena, string_view& input)
 {
     if (input.size() > 0 && input[0] == '|')
     {
         if (input.size() > 1 && input[1] == '|')
-            return nullptr;
+            return 0;
 
-        input = input.substr(1);
+        input.remove_prefix(1);
 
-        return make_unique<AST>(AST::PIPE, "|");
+        return arena.make(AST::PIPE, "|");
     }
 
-    return nullptr;
-}
\ No newline at end of file
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include <script.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+using namespace std;
+
+static const char MAGIC[4] = { 's', 'h', 'c', '3' };
+
+bool Script::read(const string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+    text.clear();
+
+    char buf[65536];
+    ssize_t len;
+
+    while ((len = ::read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (len == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            close(fd);
+            return false;
+        }
+
+        text.append(buf, len);
+    }
+
+    close(fd);
+
+    return true;
+}
+
+static void put_varint(string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+
+    out += static_cast<char>(value);
+}
+
+static bool get_varint(string_view& in, uint64_t& value)
+{
+    value = 0;
+
+    for (int shift = 0; shift < 64 && !in.empty(); shift += 7)
+    {
+        unsigned char byte = in.front();
+        in.remove_prefix(1);
+
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// type, text offset from the line start, text size and child count,
+// then the children, links are rebuilt by appending on the way back
+static void encode(const Arena& arena, AST_id id, string& out, size_t line_offset, const char* source, size_t source_size, string& extra)
+{
+    const AST& node = arena.nodes[id];
+    size_t offset = node.data.data() - source;
+
+    // text the parser spelled out itself goes after the source
+    if (node.data.data() < source || offset + node.data.size() > source_size)
+    {
+        offset = source_size + extra.size();
+        extra += node.data;
+    }
+
+    out += static_cast<char>(node.type);
+    put_varint(out, offset - line_offset);
+    put_varint(out, node.data.size());
+    put_varint(out, node.count);
+
+    for (AST_id child = node.first; child; child = arena.nodes[child].next)
+        encode(arena, child, out, line_offset, source, source_size, extra);
+}
+
+static AST_id decode(string_view& in, Arena& arena, string_view text, size_t line_offset)
+{
+    uint64_t offset, size, count;
+    unsigned char type = in.empty() ? 0xff : in.front();
+
+    in.remove_prefix(in.empty() ? 0 : 1);
+
+    if (type > AST::REDIRECT || !get_varint(in, offset) || !get_varint(in, size) || !get_varint(in, count))
+        throw runtime_error("damaged script cache");
+
+    if (offset > text.size() - line_offset || size > text.size() - line_offset - offset)
+        throw runtime_error("damaged script cache");
+
+    AST_id id = arena.make(static_cast<AST::NodeType>(type), text.substr(line_offset + offset, size));
+
+    for (uint64_t i = 0; i < count; i++)
+        arena.append(id, decode(in, arena, text, line_offset));
+
+    return id;
+}
+
+// parses every line on its own like run_file used to
+void Script::compile()
+{
+    size_t source_size = text.size();
+    string extra;
+    Arena arena;
+
+    lines.clear();
+    code.clear();
+
+    size_t start = 0;
+
+    while (start < source_size)
+    {
+        size_t end = text.find('\n', start);
+
+        if (end == string::npos)
+            end = source_size;
+
+        Line line = { static_cast<uint32_t>(start), static_cast<uint32_t>(end - start), 0, 0, static_cast<uint32_t>(code.size()), 0 };
+        string_view cursor(text.data() + start, end - start);
+
+        start = end + 1;
+        arena.reset();
+
+        try
+        {
+            AST_id tree = parse_shell_input(arena, cursor);
+
+            if (tree)
+                encode(arena, tree, code, line.offset, text.data(), source_size, extra);
+        }
+        catch (const runtime_error&)
+        {
+            line.error = 1;
+        }
+
+        line.parsed = line.size - cursor.size();
+        line.code_size = code.size() - line.code_offset;
+
+        // a failed line may have left part of its tree behind
+        if (line.error)
+        {
+            code.resize(line.code_offset);
+            line.code_size = 0;
+        }
+
+        lines.push_back(line);
+    }
+
+    text += extra;
+}
+
+// the cache is only good for the exact file it was made from
+bool Script::load_cache(const string& cache, const string& key, const struct stat& st)
+{
+    Script loaded;
+
+    if (!loaded.read(cache))
+        return false;
+
+    string_view data = loaded.text;
+
+    auto take = [&](void* dest, size_t size)
+    {
+        if (data.size() < size)
+            return false;
+
+        memcpy(dest, data.data(), size);
+        data.remove_prefix(size);
+
+        return true;
+    };
+
+    char magic[4];
+    uint64_t key_size, sec, nsec, size, text_size, line_count, code_size;
+
+    if (!take(magic, 4) || memcmp(magic, MAGIC, 4) != 0)
+        return false;
+
+    if (!take(&key_size, 8) || data.size() < key_size || data.substr(0, key_size) != key)
+        return false;
+
+    data.remove_prefix(key_size);
+
+    if (!take(&sec, 8) || !take(&nsec, 8) || !take(&size, 8))
+        return false;
+
+    if (sec != static_cast<uint64_t>(st.st_mtim.tv_sec) || nsec != static_cast<uint64_t>(st.st_mtim.tv_nsec) || size != static_cast<uint64_t>(st.st_size))
+        return false;
+
+    if (!take(&text_size, 8) || data.size() < text_size)
+        return false;
+
+    text = data.substr(0, text_size);
+    data.remove_prefix(text_size);
+
+    if (!take(&line_count, 8) || data.size() / sizeof(Line) < line_count)
+        return false;
+
+    lines.resize(line_count);
+    take(lines.data(), line_count * sizeof(Line));
+
+    if (!take(&code_size, 8) || data.size() != code_size)
+        return false;
+
+    code = data;
+
+    // trees are checked as they are decoded, the ranges here
+    for (const Line& line : lines)
+    {
+        if (static_cast<uint64_t>(line.offset) + line.size > text.size() || line.parsed > line.size)
+            return false;
+
+        if (static_cast<uint64_t>(line.code_offset) + line.code_size > code.size())
+            return false;
+    }
+
+    return true;
+}
+
+// written aside and renamed so a concurrent run never reads half of it
+void Script::save_cache(const string& cache, const string& key, const struct stat& st) const
+{
+    string data(MAGIC, 4);
+
+    auto put = [&](const void* src, size_t size)
+    {
+        data.append(static_cast<const char*>(src), size);
+    };
+
+    uint64_t key_size = key.size();
+    uint64_t sec = st.st_mtim.tv_sec;
+    uint64_t nsec = st.st_mtim.tv_nsec;
+    uint64_t size = st.st_size;
+    uint64_t text_size = text.size();
+    uint64_t line_count = lines.size();
+    uint64_t code_size = code.size();
+
+    put(&key_size, 8);
+    put(key.data(), key.size());
+    put(&sec, 8);
+    put(&nsec, 8);
+    put(&size, 8);
+    put(&text_size, 8);
+    put(text.data(), text.size());
+    put(&line_count, 8);
+    put(lines.data(), lines.size() * sizeof(Line));
+    put(&code_size, 8);
+    put(code.data(), code.size());
+    string temp = cache + "." + to_string(getpid());
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (fd == -1)
+        return;
+
+    size_t done = 0;
+
+    while (done < data.size())
+    {
+        ssize_t written = write(fd, data.data() + done, data.size() - done);
+
+        if (written == -1 && errno != EINTR)
+            break;
+
+        if (written > 0)
+            done += written;
+    }
+
+    close(fd);
+
+    if (done == data.size())
+        rename(temp.c_str(), cache.c_str());
+    else
+        unlink(temp.c_str());
+}
+
+string_view Script::line(size_t i) const
+{
+    return string_view(text).substr(lines[i].offset, lines[i].size);
+}
+
+// builds the tree of a line in the arena the way the parser would have
+AST_id Script::load(size_t i, Arena& arena) const
+{
+    const Line& line = lines[i];
+
+    if (line.code_size == 0)
+        return 0;
+
+    string_view in = string_view(code).substr(line.code_offset, line.code_size);
+
+    return decode(in, arena, text, line.offset);
+}
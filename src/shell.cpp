@@ -4,11 +4,24 @@ using namespace std;
 
 void Shell::run()
 {
+    string path = history_path();
+
+    if (!path.empty())
+        history.load(path, hist_size());
+
+    init_job_control();
+
     while (true)
     {
-        prompt();
+        notify_jobs();
+        start_prompt();
+
+        bool more = input.get();
 
-        if (!input.get())
+        // a prompt still in the works is for a state that is gone now
+        stop_prompt();
+
+        if (!more)
             execute("echo exit ; exit");
 
         execute(input.data);
@@ -19,62 +32,145 @@ void Shell::run_file(int argc, char** argv)
 {
     const char* file_path = argv[1];
 
-    ifstream file(file_path);
+    struct stat st;
+    Script script;
 
-    if (!file.is_open())
+    if (stat(file_path, &st) == -1)
     {
         cerr << name << ": failed to open file '" << file_path << "'\n";
         exit(EXIT_FAILURE);
     }
 
+    // parsing happens once per version of the file, later runs load the result
+    char* real = realpath(file_path, nullptr);
+    string key = real ? real : file_path;
+    string cache = S_ISREG(st.st_mode) ? cache_path("scripts", key) : "";
+
+    free(real);
+
+    if (cache.empty() || !script.load_cache(cache, key, st))
+    {
+        if (!script.read(file_path))
+        {
+            cerr << name << ": failed to open file '" << file_path << "'\n";
+            exit(EXIT_FAILURE);
+        }
+
+        script.compile();
+
+        if (!cache.empty())
+            script.save_cache(cache, key, st);
+    }
+
     for (int i = 1; i < argc; i++)
         vars.set(to_string(i - 1), argv[i]);
 
-    string line;
+    for (size_t i = 0; i < script.lines.size(); i++)
+    {
+        // no prompt to report at, background jobs are kept for wait
+        jobs.reap();
+
+        if (script.lines[i].error)
+        {
+            execute(string(script.line(i)));
+            continue;
+        }
 
-    while (getline(file, line))
-        execute(line);
+        size_t allocs = alloc_count();
+        Arena& arena = acquire_arena();
 
-    file.close();
+        try
+        {
+            execute_parsed(arena, script.load(i, arena), true, allocs);
+        }
+        catch (const runtime_error& e)
+        {
+            report_error(script.line(i), script.lines[i].parsed, e);
+        }
+
+        release_arena();
+    }
 }
 
 void Shell::execute(string input, bool save_status)
 {
-    string start_input = input;
+    string_view cursor = input;
+    size_t allocs = alloc_count();
+    Arena& arena = acquire_arena();
 
     try
     {
-        AST_ptr tree = parse_shell_input(input);
-
-        if (!tree)
-            return;
-
-        make_regular(tree);
-        sub_commands(tree);
-
-        if (print_tree)
-            tree->print();
-
-        int status = execute_tree(tree);
+        AST_id tree = parse_shell_input(arena, cursor);
 
-        if (save_status)
-            vars.set("status", to_string(status));
+        execute_parsed(arena, tree, save_status, allocs);
     }
     catch (const runtime_error& e)
     {
         // can catch pipe failed
+        report_error(input, input.size() - cursor.size(), e);
+    }
+
+    release_arena();
+}
+
+// everything execute does after parsing, scripts come in here with a loaded tree
+void Shell::execute_parsed(Arena& arena, AST_id tree, bool save_status, size_t allocs)
+{
+    if (!tree)
+        return;
 
-        cout << start_input << endl;
+    make_regular(arena, tree);
+    sub_commands(arena, tree);
 
-        for (size_t i = 0; i < start_input.size() - input.size(); i++)
-            cout << " ";
+    if (print_tree)
+        arena.print(tree);
 
-        cout << "^\n";
+    if (print_allocs)
+        cerr << "allocations: " << alloc_count() - allocs << endl;
 
-        cerr << name << ": " << e.what() << endl;
+    pipestatus.clear();
+
+    int status = execute_tree(arena, tree);
+
+    if (save_status)
+    {
+        vars.set("status", to_string(status));
+
+        // one status per stage of the last pipeline that ran
+        string list;
+
+        for (int stage : pipestatus)
+            list += (list.empty() ? "" : " ") + to_string(stage);
+
+        vars.set("pipestatus", list.empty() ? to_string(status) : list);
     }
 }
 
+void Shell::report_error(string_view input, size_t pos, const runtime_error& e)
+{
+    cout << input << endl;
+
+    for (size_t i = 0; i < pos; i++)
+        cout << " ";
+
+    cout << "^\n";
+
+    cerr << name << ": " << e.what() << endl;
+}
+
+Arena& Shell::acquire_arena()
+{
+    if (arena_depth == arenas.size())
+        arenas.push_back(make_unique<Arena>());
+
+    return *arenas[arena_depth++];
+}
+
+void Shell::release_arena()
+{
+    arenas[--arena_depth]->reset();
+}
+
 void Shell::sync_vars()
 {
     for (int i = 0; environ[i] != nullptr; i++)
@@ -93,6 +189,62 @@ void Shell::sync_vars()
     }
 }
 
+size_t Shell::hist_size()
+{
+    return vars.get_number("HISTSIZE", 100);
+}
+
+// where a cache entry for key lives, dir is a folder under ~/.cache/shell
+string Shell::cache_path(const string& dir, const string& key)
+{
+    string cache_home;
+
+    if (!vars.get("XDG_CACHE_HOME", cache_home))
+    {
+        string home;
+
+        if (!vars.get("HOME", home))
+            return "";
+
+        cache_home = home + "/.cache";
+    }
+
+    mkdir(cache_home.c_str(), 0700);
+    mkdir((cache_home + "/shell").c_str(), 0700);
+    mkdir((cache_home + "/shell/" + dir).c_str(), 0700);
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016zx", hash<string>{}(key));
+
+    return cache_home + "/shell/" + dir + "/" + name;
+}
+
+string Shell::history_path()
+{
+    string path;
+
+    if (vars.get("HISTFILE", path))
+        return path;
+
+    string data_home;
+
+    if (!vars.get("XDG_DATA_HOME", data_home))
+    {
+        string home;
+
+        if (!vars.get("HOME", home))
+            return "";
+
+        data_home = home + "/.local/share";
+        mkdir((home + "/.local").c_str(), 0700);
+    }
+
+    mkdir(data_home.c_str(), 0700);
+    mkdir((data_home + "/shell").c_str(), 0700);
+
+    return data_home + "/shell/history";
+}
+
 void Shell::add_history(string str)
 {
     if (str.empty())
@@ -101,49 +253,223 @@ void Shell::add_history(string str)
     if (!history.empty() && str == history.back())
         return;
 
-    size_t hist_size = 100;
-    string hist_size_str;
+    history.add(str, hist_size());
+}
+
+std::string Shell::get_history(size_t index)
+{
+    if (index >= history.size())
+        return "";
+
+    return string(history[history.size() - index - 1]);
+}
+
+// reads straight into the end of target, the chunk grows with
+// the output so big captures take few reads and no extra copy
+ssize_t read_into(int fd, string& target)
+{
+    size_t size = target.size();
+    size_t chunk = size < 4096 ? 4096 : size > (1 << 20) ? (1 << 20) : size;
+
+    if (target.capacity() < size + chunk)
+        target.reserve(max(target.capacity() * 2, size + chunk));
+
+    target.resize(size + chunk);
+
+    ssize_t bytes_read = read(fd, target.data() + size, chunk);
+
+    target.resize(size + (bytes_read > 0 ? bytes_read : 0));
+
+    return bytes_read;
+}
+
+int Shell::prompt_wait()
+{
+    return vars.get_number("prompt_wait", 50);
+}
+
+// the prompt command runs in a child so the editor can take keys
+// meanwhile, its output is captured so the editor knows the column
+// it leaves the cursor in, and until it is done the last one shows
+void Shell::start_prompt()
+{
+    string prompt;
+
+    if (!vars.get("prompt", prompt))
+    {
+        prompt_text = "> ";
+        return;
+    }
+
+    int out[2], err[2];
+
+    if (pipe2(out, O_CLOEXEC) == -1)
+        return;
 
-    if (vars.get("HISTSIZE", hist_size_str))
+    if (pipe2(err, O_CLOEXEC) == -1)
     {
-        try
+        close(out[0]);
+        close(out[1]);
+        return;
+    }
+
+    cout << flush;
+    cerr << flush;
+
+    prompt_job = Substitution{};
+    prompt_job.pid = fork();
+
+    if (prompt_job.pid == 0)
+    {
+        // its own group, so stopping it takes what it started along
+        setpgid(0, 0);
+
+        // the terminal belongs to the editor now
+        int null = open("/dev/null", O_RDONLY);
+
+        dup2(null, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+
+        become_child();
+
+        print_tree = false;
+        execute(prompt, false);
+        exit(EXIT_SUCCESS);
+    }
+
+    close(out[1]);
+    close(err[1]);
+
+    if (prompt_job.pid == -1)
+    {
+        close(out[0]);
+        close(err[0]);
+        return;
+    }
+
+    setpgid(prompt_job.pid, prompt_job.pid);
+
+    prompt_job.out = out[0];
+    prompt_job.err = err[0];
+}
+
+// reads what the prompt child wrote for up to timeout ms,
+// true when that finished it and prompt_text is fresh
+bool Shell::poll_prompt(int timeout)
+{
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+
+    while (prompt_job.pid > 0)
+    {
+        pollfd fds[2] = { { prompt_job.out, POLLIN, 0 }, { prompt_job.err, POLLIN, 0 } };
+        string* targets[2] = { &prompt_job.output, &prompt_job.errors };
+
+        if (prompt_job.out == -1 && prompt_job.err == -1)
         {
-            hist_size = stoi(hist_size_str);
+            jobs.wait_child(prompt_job.pid);
+
+            prompt_text = prompt_job.errors + prompt_job.output;
+            prompt_job = Substitution{};
+
+            return true;
         }
-        catch (...)
+
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        int ready = poll(fds, 2, left > 0 ? left : 0);
+
+        if (ready == -1 && errno != EINTR)
+            return false;
+
+        if (ready <= 0)
         {
+            if (left <= 0)
+                return false;
 
+            continue;
         }
-    }
 
-    if (history.size() >= hist_size)
-        history.erase(history.begin());
+        for (int i = 0; i < 2; i++)
+        {
+            if (fds[i].fd < 0 || !fds[i].revents)
+                continue;
+
+            ssize_t bytes_read = read_into(fds[i].fd, *targets[i]);
+
+            if (bytes_read == 0 || (bytes_read == -1 && errno != EINTR))
+            {
+                close(fds[i].fd);
+                (i == 0 ? prompt_job.out : prompt_job.err) = -1;
+            }
+        }
+    }
 
-    history.push_back(str);
+    return false;
 }
 
-std::string Shell::get_history(size_t index)
+void Shell::stop_prompt()
 {
-    if (index >= history.size())
-        return "";
+    if (prompt_job.pid <= 0)
+        return;
+
+    // the prompt's own children like git go too
+    kill(-prompt_job.pid, SIGKILL);
+
+    if (prompt_job.out != -1)
+        close(prompt_job.out);
+
+    if (prompt_job.err != -1)
+        close(prompt_job.err);
+
+    jobs.wait_child(prompt_job.pid);
 
-    return history[history.size() - index - 1];
+    prompt_job = Substitution{};
 }
 
-void Shell::prompt()
+// runs a command line the way a substitution does and returns its output
+string Shell::capture(const string& input, int& status)
 {
-    string prompt;
+    string_view cursor = input;
+    Arena& arena = acquire_arena();
+    vector<Substitution> subs;
 
-    if (!vars.get("prompt", prompt))
-        cout << "> " << flush;
-    else
-        execute(prompt, false);
+    status = EXIT_FAILURE;
+
+    try
+    {
+        AST_id tree = parse_shell_input(arena, cursor);
+
+        if (tree)
+        {
+            make_regular(arena, tree);
+
+            subs.emplace_back(tree);
+            start_substitution(arena, subs.back());
+            collect_substitutions(subs);
+
+            cerr << subs.back().errors;
+            status = subs.back().status;
+        }
+        else
+            status = 0;
+    }
+    catch (const runtime_error& e)
+    {
+        cerr << name << ": " << e.what() << endl;
+    }
+
+    release_arena();
+
+    return subs.empty() ? "" : move(subs.back().output);
 }
 
 #define ADD_BUILTIN(x) builtins[#x] = [this](int argc, char** argv) { return this->__##x(argc, argv); };
 
 void Shell::init()
 {
+    stdout_buf = cout.rdbuf();
+    stderr_buf = cerr.rdbuf();
+
     ADD_BUILTIN(exit);
     ADD_BUILTIN(cd);
     ADD_BUILTIN(set);
@@ -152,6 +478,31 @@ void Shell::init()
     ADD_BUILTIN(alias);
     ADD_BUILTIN(unalias);
     ADD_BUILTIN(history);
+    ADD_BUILTIN(hash);
+    ADD_BUILTIN(suggestions);
+    ADD_BUILTIN(printf);
+    ADD_BUILTIN(echo);
+    ADD_BUILTIN(true);
+    ADD_BUILTIN(false);
+    ADD_BUILTIN(test);
+    ADD_BUILTIN(memo);
+    ADD_BUILTIN(jobs);
+    ADD_BUILTIN(fg);
+    ADD_BUILTIN(bg);
+    ADD_BUILTIN(wait);
+    ADD_BUILTIN(parallel);
+
+    builtins["["] = builtins["test"];
+
+    // builtins that leave the shell untouched, these run
+    // in-process when they make up a whole command substitution
+    pure_builtins = { "printf", "echo", "true", "false", "test", "[" };
+
+    vars.on_change = [this](const string& name)
+    {
+        if (name == "PATH")
+            commands.clear();
+    };
 
     sync_vars();
 
@@ -174,575 +525,2960 @@ void Shell::init()
     }
 }
 
-vector<string> Shell::get_sub_lines(const string& input)
+// like other shells the interactive one takes its own process group
+// and the terminal, and hands both to each foreground job in turn
+void Shell::init_job_control()
 {
-    int pipefd[2];
+    watch_children();
 
-    if (pipe(pipefd) == -1)
-        throw runtime_error("pipe failed");
+    if (!isatty(STDIN_FILENO))
+        return;
 
-    pid_t pid = fork();
+    // started in the background, wait to be brought forward
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+        kill(-shell_pgid, SIGTTIN);
 
-    if (pid == 0)
-    {
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[0]);
-        close(pipefd[1]);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
 
-        print_tree = false;
-        execute(input);
-        exit(EXIT_SUCCESS);
-    }
-    else
-    {
-        close(pipefd[1]);
+    // fails for a session leader, which leads its group already
+    setpgid(0, 0);
+
+    shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    tcgetattr(STDIN_FILENO, &shell_modes);
 
-        char buffer[512];
-        ssize_t bytes_read;
-        string output = "";
+    job_control = true;
+}
 
-        while ((bytes_read = read(pipefd[0], buffer, 512)) > 0)
-            output.append(buffer, bytes_read);
+// for forked children that go on running shell code, the signals
+// ignored for job control come back and only the shell has the terminal
+void Shell::become_child()
+{
+    if (job_control)
+    {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
 
-        wait(nullptr);
-        close(pipefd[0]);
+    signal(SIGCHLD, SIG_DFL);
 
-        istringstream iss(output);
-        vector<string> lines;
-        string line;
+    // pids in the tables are the parent's children, not this one's
+    jobs.owners.clear();
+    jobs.unclaimed.clear();
 
-        while (getline(iss, line))
-            lines.push_back(line);
+    // the thread that could release the index lock does not exist here
+    commands.use_index = false;
 
-        return lines;
-    }
+    job_control = false;
 }
 
-void Shell::make_regular(AST_ptr& leaf)
+// reports jobs that ended or stopped since the last prompt, ended ones are forgotten
+void Shell::notify_jobs()
 {
-    if (leaf->type == AST::TILDE)
+    take_children();
+    jobs.reap();
+
+    for (size_t i = 0; i < jobs.list.size();)
     {
-        leaf->type = AST::REGULAR;
+        Job& job = jobs.list[i];
 
-        string home;
-        vars.get("HOME", home);
+        if (!job.notified && job.state != Job::RUNNING)
+        {
+            cerr << "[" << job.id << "]" << jobs.mark(job) << "  " << describe(job) << "  " << job.command << "\n";
+            job.notified = true;
+        }
 
-        leaf->data = home;
+        if (job.state == Job::DONE)
+            jobs.list.erase(jobs.list.begin() + i);
+        else
+            i++;
     }
-    else if (leaf->type == AST::VAR)
-    {
-        leaf->type = AST::REGULAR;
+}
 
-        string var;
-        vars.get(leaf->data, var);
+bool Shell::runs_in_process(Arena& arena, AST_id tree)
+{
+    if (arena[tree].type == AST::COMMAND)
+        return pure_builtins.find(string(arena[tree].data)) != pure_builtins.end();
 
-        leaf->data = var;
-    }
-    else if (leaf->type == AST::SQ_STRING)
-    {
-        leaf->type = AST::REGULAR;
-    }
-    else if (leaf->type == AST::ESCAPE)
-    {
-        leaf->type = AST::REGULAR;
+    // redirections move fds, not cout
+    if (arena[tree].type == AST::PIPE || arena[tree].type == AST::BACKGROUND || arena[tree].type == AST::REDIRECT)
+        return false;
 
-        if (leaf->data == "a") leaf->data = "\a";
-        if (leaf->data == "b") leaf->data = "\b";
-        if (leaf->data == "e") leaf->data = "\e";
-        if (leaf->data == "f") leaf->data = "\f";
-        if (leaf->data == "n") leaf->data = "\n";
-        if (leaf->data == "r") leaf->data = "\r";
-        if (leaf->data == "t") leaf->data = "\t";
-        if (leaf->data == "v") leaf->data = "\v";
-    }
-    else
-    {
-        for (auto& child : leaf->children)
-            make_regular(child);
-    }
+    for (AST_id child = arena[tree].first; child; child = arena[child].next)
+        if (!runs_in_process(arena, child))
+            return false;
+
+    return true;
 }
 
-void cartesian_prod(const vector<vector<string>>& vecs, vector<string>& current, vector<vector<string>>& result, size_t depth = 0)
+void Shell::find_substitutions(Arena& arena, AST_id tree, vector<Substitution>& subs)
 {
-    if (depth == vecs.size())
+    // the file of a redirection
+    if (arena[tree].type == AST::WORD)
     {
-        result.push_back(current);
+        for (AST_id part = arena[tree].first; part; part = arena[part].next)
+            if (arena[part].type == AST::SUBCOMMAND)
+                subs.emplace_back(arena[part].first);
+
         return;
     }
 
-    for (const string& s : vecs[depth])
+    if (arena[tree].type != AST::COMMAND)
     {
-        current.push_back(s);
-        cartesian_prod(vecs, current, result, depth + 1);
-        current.pop_back();
-    }
-}
+        for (AST_id child = arena[tree].first; child; child = arena[child].next)
+            find_substitutions(arena, child, subs);
 
-vector<vector<string>> cartesian_prod(const vector<vector<string>>& vecs)
-{
-    vector<vector<string>> result;
-    vector<string> current;
-
-    cartesian_prod(vecs, current, result);
+        return;
+    }
 
-    return result;
+    for (AST_id word = arena[tree].first; word; word = arena[word].next)
+        for (AST_id part = arena[word].first; part; part = arena[part].next)
+            if (arena[part].type == AST::SUBCOMMAND)
+                subs.emplace_back(arena[part].first);
 }
 
-vector<AST_ptr> Shell::expand_word(const AST_ptr& word)
+void Shell::start_substitution(Arena& arena, Substitution& sub)
 {
-    vector<vector<string>> results;
-
-    for (size_t i = 0; i < word->children.size(); i++)
-        if (word->children[i]->type == AST::SUBCOMMAND)
-            results.push_back(get_sub_lines(word->children[i]->data));
-
-    vector<vector<string>> cartesian = cartesian_prod(results);
+    if (!sub.tree)
+        return;
 
-    vector<AST_ptr> ret;
+    sub_commands(arena, sub.tree);
 
-    for (const auto& config : cartesian)
+    if (runs_in_process(arena, sub.tree))
     {
-        int i = 0;
-        ret.push_back(make_unique<AST>(AST::WORD, ""));
+        ostringstream out, err;
+        streambuf* old_out = cout.rdbuf(out.rdbuf());
+        streambuf* old_err = cerr.rdbuf(err.rdbuf());
 
-        for (const auto& child : word->children)
-            if (child->type == AST::SUBCOMMAND)
-                ret.back()->children.push_back(make_unique<AST>(AST::REGULAR, config[i++]));
-            else
-                ret.back()->children.push_back(make_unique<AST>(child->type, child->data));
-    }
+        try
+        {
+            sub.status = execute_tree(arena, sub.tree);
+        }
+        catch (...)
+        {
+            cout.rdbuf(old_out);
+            cerr.rdbuf(old_err);
+            throw;
+        }
 
-    return ret;
-}
+        cout.rdbuf(old_out);
+        cerr.rdbuf(old_err);
 
-void Shell::sub_commands(AST_ptr& tree)
-{
-    if (tree->type != AST::COMMAND)
-    {
-        for (auto& child : tree->children)
-            sub_commands(child);
+        sub.output = out.str();
+        sub.errors = err.str();
 
         return;
     }
 
-    vector<AST_ptr> new_children;
+    int out[2], err[2];
 
-    for (const auto& word : tree->children)
-    {
-        vector<AST_ptr> new_words = expand_word(word);
+    if (pipe2(out, O_CLOEXEC) == -1)
+        throw runtime_error("pipe failed");
 
-        new_children.insert(new_children.end(), make_move_iterator(new_words.begin()), make_move_iterator(new_words.end()));
+    if (pipe2(err, O_CLOEXEC) == -1)
+    {
+        close(out[0]);
+        close(out[1]);
+        throw runtime_error("pipe failed");
     }
 
-    tree->children = move(new_children);
+    // cout may be redirected into an in-process substitution,
+    // what is pending for the real stdout must not reach the child
+    cout << flush;
+    cerr << flush;
+    fflush(stdout);
 
-    if (tree->children.empty())
-        return;
+    sub.pid = fork();
 
-    for (const auto& word : tree->children)
+    if (sub.pid == -1)
     {
-        for (const auto& reg : word->children)
-            word->data += reg->data;
-
-        word->children.clear();
+        close(out[0]);
+        close(out[1]);
+        close(err[0]);
+        close(err[1]);
+        throw runtime_error("fork failed");
     }
 
-    unordered_set<string> expanded;
-    string expansion;
-    string cmd = tree->children[0]->data;
-
-    while (aliases.get(cmd, expansion) && expanded.find(cmd) == expanded.end())
+    if (sub.pid == 0)
     {
-        expanded.insert(cmd);
-
-        tree->children.erase(tree->children.begin());
+        cout.rdbuf(stdout_buf);
+        cerr.rdbuf(stderr_buf);
 
-        istringstream iss(expansion);
-        string word;
-        size_t i = 0;
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
 
-        while (iss >> word)
-            tree->children.insert(tree->children.begin() + i++, make_unique<AST>(AST::WORD, word));
+        become_child();
 
-        cmd = tree->children[0]->data;
+        print_tree = false;
+        exit(execute_tree(arena, sub.tree));
     }
 
-    tree->data = cmd;
+    close(out[1]);
+    close(err[1]);
+
+    // fewer wakeups for big outputs, the kernel may refuse and that's fine
+    fcntl(out[0], F_SETPIPE_SZ, 1 << 20);
+
+    sub.out = out[0];
+    sub.err = err[0];
 }
 
-int Shell::execute_tree(const AST_ptr& tree)
+void Shell::collect_substitutions(vector<Substitution>& subs)
 {
-    if (tree->type == AST::COMMAND)
-        return execute_command(tree);
+    vector<pollfd> fds;
+    vector<string*> targets;
 
-    if (tree->type == AST::PIPE)
-        return execute_pipeline(tree);
-
-    if (tree->type == AST::COMMA)
-    {
-        int status = 0;
+    for (auto& sub : subs)
+        if (sub.pid > 0)
+        {
+            fds.push_back({ sub.out, POLLIN, 0 });
+            targets.push_back(&sub.output);
 
-        for (const auto& child : tree->children)
-            status = execute_tree(child);
+            fds.push_back({ sub.err, POLLIN, 0 });
+            targets.push_back(&sub.errors);
+        }
 
-        return status;
-    }
+    size_t open_fds = fds.size();
 
-    if (tree->type == AST::LOGICAL && tree->data == "&&")
+    while (open_fds > 0)
     {
-        int status = execute_tree(tree->children[0]);
+        if (poll(fds.data(), fds.size(), -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
-            return execute_tree(tree->children[1]);
+            throw runtime_error("poll failed");
+        }
 
-        return status;
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (fds[i].fd < 0 || !fds[i].revents)
+                continue;
+
+            ssize_t bytes_read = read_into(fds[i].fd, *targets[i]);
+
+            if (bytes_read > 0)
+                continue;
+            else if (bytes_read == 0 || errno != EINTR)
+            {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open_fds--;
+            }
+        }
     }
 
-    if (tree->type == AST::LOGICAL && tree->data == "||")
+    for (auto& sub : subs)
+        if (sub.pid > 0)
+            sub.status = exit_code(jobs.wait_child(sub.pid));
+}
+
+// views into output, one per line like getline would produce
+vector<string_view> split_lines(string_view output)
+{
+    vector<string_view> lines;
+    const char* pos = output.data();
+    const char* end = pos + output.size();
+
+    while (pos < end)
     {
-        int status = execute_tree(tree->children[0]);
+        const char* nl = static_cast<const char*>(memchr(pos, '\n', end - pos));
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
-            return status;
+        if (!nl)
+            nl = end;
 
-        return execute_tree(tree->children[1]);
+        lines.emplace_back(pos, nl - pos);
+        pos = nl + 1;
     }
 
-    return 0;
+    return lines;
 }
 
-char** get_argv(const AST_ptr& command)
+void Shell::make_regular(Arena& arena, AST_id leaf)
 {
-    int argc = command->children.size();
-    char** argv = new char* [argc + 1];
+    AST& node = arena[leaf];
 
-    for (int i = 0; i < argc; ++i)
+    if (node.type == AST::TILDE)
     {
-        argv[i] = new char[command->children[i]->data.size() + 1];
-        strcpy(argv[i], command->children[i]->data.c_str());
+        node.type = AST::REGULAR;
+
+        string home;
+        vars.get("HOME", home);
+
+        node.data = arena.store(home);
     }
+    else if (node.type == AST::VAR)
+    {
+        node.type = AST::REGULAR;
 
-    argv[argc] = nullptr;
+        string var;
+        vars.get(string(node.data), var);
 
-    return argv;
+        node.data = arena.store(var);
+    }
+    else if (node.type == AST::SQ_STRING)
+    {
+        node.type = AST::REGULAR;
+    }
+    else if (node.type == AST::REGULAR && has_wildcard(node.data))
+    {
+        node.type = AST::GLOB;
+    }
+    else if (node.type == AST::ESCAPE)
+    {
+        node.type = AST::REGULAR;
+
+        if (node.data == "a") node.data = "\a";
+        if (node.data == "b") node.data = "\b";
+        if (node.data == "e") node.data = "\e";
+        if (node.data == "f") node.data = "\f";
+        if (node.data == "n") node.data = "\n";
+        if (node.data == "r") node.data = "\r";
+        if (node.data == "t") node.data = "\t";
+        if (node.data == "v") node.data = "\v";
+    }
+    else
+    {
+        for (AST_id child = node.first; child; child = arena[child].next)
+            make_regular(arena, child);
+    }
 }
 
-void free_argv(char** argv)
+size_t sat_add(size_t a, size_t b)
 {
-    if (!argv)
-        return;
-
-    for (int i = 0; argv[i] != nullptr; i++)
-        delete[] argv[i];
+    size_t res;
+    return __builtin_add_overflow(a, b, &res) ? SIZE_MAX : res;
+}
 
-    delete[] argv;
+size_t sat_mul(size_t a, size_t b)
+{
+    size_t res;
+    return __builtin_mul_overflow(a, b, &res) ? SIZE_MAX : res;
 }
 
-int Shell::execute_command(const AST_ptr& command)
+// concatenates the parts of a word into the arena
+// config holds the outputs picked for its subcommands, left to right
+string_view join_word(Arena& arena, AST_id word, const vector<string_view>& config)
 {
-    if (command->children.empty())
-        return 0;
+    AST_id first = arena[word].first;
 
-    int argc = command->children.size();
-    char** argv = get_argv(command);
+    if (config.empty() && !arena[first].next)
+        return arena[first].data;
 
-    int status = exec_and_return(argc, argv);
+    size_t size = 0;
+    size_t i = 0;
 
-    free_argv(argv);
+    for (AST_id child = first; child; child = arena[child].next)
+        size += arena[child].type == AST::SUBCOMMAND ? config[i++].size() : arena[child].data.size();
 
-    return status;
+    char* dest = static_cast<char*>(arena.alloc(size));
+    size_t pos = 0;
+    i = 0;
+
+    for (AST_id child = first; child; child = arena[child].next)
+    {
+        string_view part = arena[child].type == AST::SUBCOMMAND ? config[i++] : arena[child].data;
+
+        memcpy(dest + pos, part.data(), part.size());
+        pos += part.size();
+    }
+
+    return string_view(dest, size);
 }
 
-int Shell::execute_pipeline(const AST_ptr& pipeline)
+// the word as a pattern, only text typed unquoted keeps its wildcards
+string glob_pattern(Arena& arena, AST_id word, const vector<string_view>& config)
 {
-    size_t n = pipeline->children.size();
-    vector<int[2]> pipes(n - 1);
-    pid_t last_pid;
-
-    for (auto& fds : pipes)
-        if (pipe(fds) == -1)
-            throw runtime_error("pipe failed");
+    string pattern;
+    size_t i = 0;
 
-    for (size_t i = 0; i < n; i++)
+    for (AST_id child = arena[word].first; child; child = arena[child].next)
     {
-        pid_t pid = fork();
-
-        if (pid == 0)
+        if (arena[child].type == AST::GLOB)
         {
-            if (i > 0)
-                dup2(pipes[i - 1][0], STDIN_FILENO);
+            pattern += arena[child].data;
+            continue;
+        }
 
-            if (i < n - 1)
-                dup2(pipes[i][1], STDOUT_FILENO);
+        string_view part = arena[child].type == AST::SUBCOMMAND ? config[i++] : arena[child].data;
 
-            for (const auto& fds : pipes)
-            {
-                close(fds[0]);
-                close(fds[1]);
-            }
+        for (char ch : part)
+        {
+            if (ch == '*' || ch == '?' || ch == '[' || ch == ']' || ch == '\\')
+                pattern += '\\';
 
-            if (pipeline->children[i]->children.empty())
-                exit(EXIT_SUCCESS);
+            pattern += ch;
+        }
+    }
 
-            int argc = pipeline->children[i]->children.size();
-            char** argv = get_argv(pipeline->children[i]);
+    return pattern;
+}
 
-            exec_and_exit(argc, argv);
+// walks every combination of the substitution outputs like an odometer,
+// the last one turning fastest, and appends each one as a word,
+// or the paths it matches when it has wildcards and any match
+void Shell::expand_word(Arena& arena, AST_id word, AST_id command, const vector<vector<string_view>>& lines, size_t& next, size_t& budget)
+{
+    vector<const vector<string_view>*> results;
+    size_t fixed = 0;
+    bool glob = false;
+
+    for (AST_id child = arena[word].first; child; child = arena[child].next)
+        if (arena[child].type == AST::SUBCOMMAND)
+            results.push_back(&lines[next++]);
+        else
+        {
+            fixed += arena[child].data.size();
+            glob |= arena[child].type == AST::GLOB;
         }
 
-        last_pid = pid;
-    }
+    // the size is known up front, so an oversized expansion
+    // fails before any of it is built, counted like the kernel does
+    size_t count = 1;
 
-    for (const auto& fds : pipes)
+    for (const auto* result : results)
+        count = sat_mul(count, result->size());
+
+    if (count == 0)
+        return;
+
+    size_t bytes = sat_mul(count, fixed + 1 + sizeof(char*));
+
+    for (const auto* result : results)
     {
-        close(fds[0]);
-        close(fds[1]);
+        size_t total = 0;
+
+        for (string_view line : *result)
+            total += line.size();
+
+        bytes = sat_add(bytes, sat_mul(total, count / result->size()));
     }
 
-    int status;
-    int last_status = 0;
+    if (bytes > budget)
+        throw runtime_error("argument list too long");
+
+    budget -= bytes;
 
-    for (size_t i = 0; i < n; i++)
+    vector<size_t> digits(results.size(), 0);
+    vector<string_view> config(results.size());
+
+    while (true)
     {
-        pid_t pid = wait(&status);
+        for (size_t i = 0; i < results.size(); i++)
+            config[i] = (*results[i])[digits[i]];
 
-        if (pid == last_pid)
-            last_status = status;
-    }
+        vector<string> matches;
 
-    if (WIFEXITED(last_status))
-        return WEXITSTATUS(last_status);
+        if (glob)
+            matches = expand_wildcard(glob_pattern(arena, word, config));
 
-    return 1;
-}
+        // the word itself was paid for already, its matches are not
+        for (const string& match : matches)
+        {
+            size_t cost = match.size() + 1 + sizeof(char*);
 
-bool Shell::is_builtin(const string& name)
-{
-    return builtins.find(name) != builtins.end();
+            if (cost > budget)
+                throw runtime_error("argument list too long");
+
+            budget -= cost;
+
+            arena.append(command, arena.make(AST::WORD, arena.store(match)));
+        }
+
+        if (matches.empty())
+            arena.append(command, arena.make(AST::WORD, join_word(arena, word, config)));
+
+        size_t d = results.size();
+
+        while (d > 0 && ++digits[d - 1] == results[d - 1]->size())
+            digits[--d] = 0;
+
+        if (d == 0)
+            break;
+    }
 }
 
-bool absolute_or_relative(const string& name)
+size_t Shell::arg_limit()
 {
-    return name.find('/') != string::npos;
+    long sys_limit = sysconf(_SC_ARG_MAX);
+
+    return vars.get_number("ARG_MAX", sys_limit > 0 ? sys_limit : 128 * 1024);
 }
 
-bool Shell::is_executable(const string& name)
+// runs every substitution in the tree at once, then expands
+// the words in the same left to right order they were found
+void Shell::sub_commands(Arena& arena, AST_id tree)
 {
-    struct stat file_stat;
+    vector<Substitution> subs;
 
-    if (absolute_or_relative(name))
-        return (stat(name.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode) && (file_stat.st_mode & S_IXUSR));
+    find_substitutions(arena, tree, subs);
 
-    const char* path = getenv("PATH");
+    try
+    {
+        for (auto& sub : subs)
+            start_substitution(arena, sub);
+    }
+    catch (...)
+    {
+        // the ones started before it would be left running with their pipes open
+        for (auto& sub : subs)
+            if (sub.pid > 0)
+            {
+                close(sub.out);
+                close(sub.err);
+                jobs.wait_child(sub.pid);
+            }
 
-    if (!path)
-        return false;
+        throw;
+    }
 
-    istringstream iss(path);
-    string directory;
+    collect_substitutions(subs);
 
-    while (getline(iss, directory, ':'))
-    {
-        string file_path = directory + '/' + name;
+    vector<vector<string_view>> lines;
 
-        if (stat(file_path.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode) && (file_stat.st_mode & S_IXUSR))
-            return true;
+    for (const auto& sub : subs)
+    {
+        cerr << sub.errors;
+        lines.push_back(split_lines(sub.output));
     }
 
-    return false;
+    size_t next = 0;
+
+    expand_commands(arena, tree, lines, next);
 }
 
-int Shell::exec_and_return(int argc, char** argv)
+void Shell::expand_commands(Arena& arena, AST_id tree, const vector<vector<string_view>>& lines, size_t& next)
 {
-    if (is_builtin(argv[0]))
-        return builtins[argv[0]](argc, argv);
-
-    if (is_executable(argv[0]))
+    if (arena[tree].type == AST::REDIRECT)
     {
-        pid_t pid = fork();
+        AST_id target = arena[arena[tree].first].next;
 
-        if (pid == 0)
-        {
-            execvp(argv[0], argv);
-            cerr << name << ": exec and return failed\n";
-            exit(EXIT_FAILURE);
-        }
+        expand_commands(arena, arena[tree].first, lines, next);
 
-        int status;
-        wait(&status);
+        if (!target)
+            return;
 
-        return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
-    }
+        // it has to come out as exactly one file
+        AST_id file = arena.make(AST::WORD);
+        size_t budget = arg_limit();
 
-    cerr << argv[0] << ": command not found\n";
+        expand_word(arena, target, file, lines, next, budget);
 
-    return EXIT_FAILURE;
-}
+        if (arena[file].count != 1)
+            throw runtime_error("ambiguous redirect");
 
-void Shell::exec_and_exit(int argc, char** argv)
-{
-    if (is_builtin(argv[0]))
-        exit(builtins[argv[0]](argc, argv));
+        arena[target].data = arena[arena[file].first].data;
+
+        return;
+    }
 
-    if (is_executable(argv[0]))
+    if (arena[tree].type != AST::COMMAND)
     {
-        execvp(argv[0], argv);
-        cerr << name << ": exec and exit failed\n";
-        exit(EXIT_FAILURE);
+        for (AST_id child = arena[tree].first; child; child = arena[child].next)
+            expand_commands(arena, child, lines, next);
+
+        return;
     }
 
-    cerr << argv[0] << ": command not found\n";
+    AST_id word = arena[tree].first;
+    size_t budget = arg_limit();
+    bool named = false;
 
-    exit(EXIT_FAILURE);
-}
+    arena.clear_children(tree);
 
-int Shell::__exit(int argc, char** argv)
-{
-    if (argc > 2)
+    while (word)
     {
-        cerr << "exit: too many arguments\n";
-        return 1;
-    }
+        AST_id next_word = arena[word].next;
 
-    int status = 0;
+        expand_word(arena, word, tree, lines, next, budget);
 
-    if (argc == 2)
-    {
-        try
-        {
-            status = stoi(argv[1]);
-        }
-        catch (...)
+        // builtins are never exec'd, so the kernel's limit does not apply
+        if (!named && arena[tree].first)
         {
-            cerr << "exit: status is invalid\n";
-            return 1;
+            named = true;
+
+            if (is_builtin(string(arena[arena[tree].first].data)))
+                budget = SIZE_MAX;
         }
+
+        word = next_word;
     }
+    if (!arena[tree].first)
+        return;
 
-    exit(status);
-}
+    unordered_set<string> expanded;
+    string expansion;
+    string cmd(arena[arena[tree].first].data);
 
-int Shell::__cd(int argc, char** argv)
-{
-    if (argc > 2)
+    while (aliases.get(cmd, expansion) && expanded.find(cmd) == expanded.end())
     {
-        cerr << "cd: too many arguments\n";
-        return 1;
-    }
+        expanded.insert(cmd);
 
-    char* path;
+        AST_id rest = arena[arena[tree].first].next;
 
-    if (argc == 1)
-    {
-        path = getenv("HOME");
+        arena.clear_children(tree);
 
-        if (!path)
+        istringstream iss(expansion);
+        string word;
+
+        while (iss >> word)
+            arena.append(tree, arena.make(AST::WORD, arena.store(word)));
+
+        while (rest)
         {
-            cerr << "cd: $HOME is not defined\n";
-            return 1;
-        }
-    }
-    else
-        path = argv[1];
+            AST_id next = arena[rest].next;
 
-    if (chdir(path) == -1)
-    {
-        perror("cd");
-        return 1;
-    }
+            arena[rest].next = 0;
+            arena.append(tree, rest);
 
-    char* pwd = getcwd(nullptr, 0);
+            rest = next;
+        }
 
-    vars.set("PWD", string(pwd));
+        if (!arena[tree].first)
+            return;
 
-    free(pwd);
+        cmd = arena[arena[tree].first].data;
+    }
 
-    return 0;
+    arena[tree].data = arena[arena[tree].first].data;
 }
 
-int Shell::__set(int argc, char** argv)
+int Shell::execute_tree(Arena& arena, AST_id tree)
 {
-    if (argc > 3)
+    if (arena[tree].type == AST::COMMAND || arena[tree].type == AST::REDIRECT)
+        return execute_command(arena, tree);
+
+    if (arena[tree].type == AST::PIPE)
+        return execute_pipeline(arena, tree);
+
+    if (arena[tree].type == AST::BACKGROUND)
+        return execute_background(arena, tree);
+
+    if (arena[tree].type == AST::COMMA)
     {
-        cerr << "set: too many arguments\n";
-        return 1;
+        int status = 0;
+
+        for (AST_id child = arena[tree].first; child; child = arena[child].next)
+            status = execute_tree(arena, child);
+
+        return status;
     }
 
-    if (argc == 1)
+    if (arena[tree].type == AST::LOGICAL && arena[tree].data == "&&")
     {
-        for (const auto& pair : vars.data)
-            if (!vars.is_exported(pair.first))
-                cout << pair.first << " = " << pair.second << "\e[0m\n";
+        int status = execute_tree(arena, arena[tree].first);
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            return execute_tree(arena, arena[tree].last);
+
+        return status;
+    }
+
+    if (arena[tree].type == AST::LOGICAL && arena[tree].data == "||")
+    {
+        int status = execute_tree(arena, arena[tree].first);
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            return status;
+
+        return execute_tree(arena, arena[tree].last);
     }
-    else if (argc == 2)
-        vars.set(argv[1], "");
-    else if (argc == 3)
-        vars.set(argv[1], argv[2]);
 
     return 0;
 }
 
-int Shell::__unset(int argc, char** argv)
+// the argv that hands a file without a #! line to /bin/sh
+vector<char*> sh_argv(const string& path, char** argv)
 {
-    if (argc == 2)
-        return !vars.unset(argv[1]);
+    vector<char*> args = { const_cast<char*>("/bin/sh"), const_cast<char*>(path.c_str()) };
 
-    return 0;
+    for (char** arg = argv + 1; *arg; arg++)
+        args.push_back(*arg);
+
+    args.push_back(nullptr);
+
+    return args;
 }
 
-int Shell::__export(int argc, char** argv)
+// execv without execvp's fallback for scripts, so it is done here,
+// only returns if neither exec worked
+void exec_file(const string& path, char** argv)
 {
-    if (argc == 2)
-        return !vars.export_(argv[1]);
+    execv(path.c_str(), argv);
 
-    return 0;
+    if (errno == ENOEXEC)
+        execv("/bin/sh", sh_argv(path, argv).data());
 }
 
-int Shell::__alias(int argc, char** argv)
+// posix_spawn uses clone(CLONE_VM | CLONE_VFORK) on linux,
+// so unlike fork it never copies the shell's page tables,
+// a pgid of 0 starts a new group and -1 stays in the shell's,
+// job control has the shell ignore signals the child should get
+pid_t spawn(const string& path, char** argv, const posix_spawn_file_actions_t* actions, pid_t pgid, bool job_control)
 {
-    if (argc > 3)
+    pid_t pid;
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    short flags = 0;
+
+    if (job_control)
+    {
+        sigset_t defaults;
+        sigemptyset(&defaults);
+
+        for (int sig : { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU })
+            sigaddset(&defaults, sig);
+
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        flags |= POSIX_SPAWN_SETSIGDEF;
+    }
+
+    if (pgid != -1)
+    {
+        posix_spawnattr_setpgroup(&attr, pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+
+    posix_spawnattr_setflags(&attr, flags);
+
+    int err = posix_spawn(&pid, path.c_str(), actions, &attr, argv, environ);
+
+    if (err == ENOEXEC)
+        err = posix_spawn(&pid, "/bin/sh", actions, &attr, sh_argv(path, argv).data(), environ);
+
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0)
+    {
+        cerr << argv[0] << ": " << strerror(err) << "\n";
+        return -1;
+    }
+
+    return pid;
+}
+
+// argv and its strings live in the arena, nothing to free
+char** get_argv(Arena& arena, AST_id command)
+{
+    int argc = arena[command].count;
+    char** argv = static_cast<char**>(arena.alloc((argc + 1) * sizeof(char*), alignof(char*)));
+    int i = 0;
+
+    for (AST_id word = arena[command].first; word; word = arena[word].next)
+        argv[i++] = const_cast<char*>(arena.c_str(arena[word].data));
+
+    argv[argc] = nullptr;
+
+    return argv;
+}
+
+void close_redirects(vector<Redirect>& redirects)
+{
+    for (const Redirect& r : redirects)
+        if (r.opened)
+            close(r.src);
+
+    redirects.clear();
+}
+
+void add_redirects(posix_spawn_file_actions_t* actions, const vector<Redirect>& redirects)
+{
+    for (const Redirect& r : redirects)
+        posix_spawn_file_actions_adddup2(actions, r.src, r.fd);
+}
+
+// in a forked child, nothing has to be put back
+void apply_redirects(const vector<Redirect>& redirects)
+{
+    for (const Redirect& r : redirects)
+    {
+        if (r.src == r.fd)
+            fcntl(r.fd, F_SETFD, 0);
+        else
+            dup2(r.src, r.fd);
+    }
+}
+
+// a builtin runs in the shell, so the shell's own fds point where the
+// command's go until restore_fds puts back what saved kept
+void swap_fds(const vector<Redirect>& redirects, vector<pair<int, int>>& saved)
+{
+    cout << flush;
+    cerr << flush;
+    fflush(stdout);
+
+    for (const Redirect& r : redirects)
+    {
+        bool kept = false;
+
+        for (const auto& [fd, copy] : saved)
+            if (fd == r.fd)
+                kept = true;
+
+        // -1 when it was closed, then it is closed again after
+        if (!kept)
+            saved.push_back({ r.fd, fcntl(r.fd, F_DUPFD_CLOEXEC, 10) });
+
+        dup2(r.src, r.fd);
+    }
+}
+
+void restore_fds(vector<pair<int, int>>& saved)
+{
+    cout << flush;
+    cerr << flush;
+    fflush(stdout);
+
+    for (auto it = saved.rbegin(); it != saved.rend(); it++)
+    {
+        if (it->second == -1)
+            close(it->first);
+        else
+        {
+            dup2(it->second, it->first);
+            close(it->second);
+        }
+    }
+
+    saved.clear();
+}
+
+// how a foreground job is shown once it stops
+string join_argv(char** argv)
+{
+    string text;
+
+    for (int i = 0; argv && argv[i]; i++)
+    {
+        if (i > 0)
+            text += ' ';
+
+        text += argv[i];
+    }
+
+    return text;
+}
+
+// the command under any redirections, which are opened and added in the
+// order they apply, 0 once a failure was reported
+AST_id Shell::open_redirects(Arena& arena, AST_id tree, vector<Redirect>& redirects)
+{
+    if (arena[tree].type != AST::REDIRECT)
+        return tree;
+
+    AST_id command = open_redirects(arena, arena[tree].first, redirects);
+
+    if (!command)
+        return 0;
+
+    string_view op = arena[tree].data;
+    int fd = op.find('<') != string_view::npos ? STDIN_FILENO : STDOUT_FILENO;
+    bool both = op.starts_with("&>");
+
+    if (both)
+        op.remove_prefix(1);
+    else
+    {
+        auto [end, err] = from_chars(op.data(), op.data() + op.size(), fd);
+
+        op.remove_prefix(end - op.data());
+
+        if (err == errc::result_out_of_range)
+        {
+            cerr << name << ": " << arena[tree].data << ": bad file descriptor\n";
+            close_redirects(redirects);
+            return 0;
+        }
+    }
+
+    size_t amp = op.find('&');
+
+    if (amp != string_view::npos)
+    {
+        string_view text = op.substr(amp + 1);
+        int src = -1;
+
+        from_chars(text.data(), text.data() + text.size(), src);
+
+        bool open_fd = src >= 0 && fcntl(src, F_GETFD) != -1;
+
+        for (const Redirect& r : redirects)
+            if (r.fd == src)
+                open_fd = true;
+
+        if (!open_fd)
+        {
+            cerr << name << ": " << text << ": bad file descriptor\n";
+            close_redirects(redirects);
+            return 0;
+        }
+
+        redirects.push_back({ fd, src, false });
+
+        return command;
+    }
+
+    int flags = op == "<" ? O_RDONLY : O_WRONLY | O_CREAT | (op == ">>" ? O_APPEND : O_TRUNC);
+    const char* path = arena.c_str(arena[arena[arena[tree].first].next].data);
+    int src = open(path, flags | O_CLOEXEC, 0666);
+
+    // low fds may be the targets of the redirections that follow
+    if (src != -1 && src < 10)
+    {
+        int high = fcntl(src, F_DUPFD_CLOEXEC, 10);
+
+        close(src);
+        src = high;
+    }
+
+    if (src == -1)
+    {
+        cerr << name << ": " << path << ": " << strerror(errno) << "\n";
+        close_redirects(redirects);
+        return 0;
+    }
+
+    redirects.push_back({ fd, src, true });
+
+    if (both)
+        redirects.push_back({ STDERR_FILENO, STDOUT_FILENO, false });
+
+    return command;
+}
+
+int Shell::execute_command(Arena& arena, AST_id tree)
+{
+    vector<Redirect> redirects;
+    AST_id command = open_redirects(arena, tree, redirects);
+
+    if (!command)
+        return EXIT_FAILURE;
+
+    // without words the files are still created, like other shells do
+    if (!arena[command].first)
+    {
+        close_redirects(redirects);
+        return 0;
+    }
+
+    int argc = arena[command].count;
+    char** argv = get_argv(arena, command);
+    int status;
+
+    try
+    {
+        status = exec_and_return(argc, argv, redirects);
+    }
+    catch (...)
+    {
+        close_redirects(redirects);
+        throw;
+    }
+
+    close_redirects(redirects);
+
+    return status;
+}
+
+int Shell::execute_pipeline(Arena& arena, AST_id pipeline)
+{
+    size_t n = arena[pipeline].count;
+    vector<int[2]> pipes(n - 1);
+
+    for (auto& fds : pipes)
+        if (pipe(fds) == -1)
+            throw runtime_error("pipe failed");
+
+    AST_id stage = arena[pipeline].first;
+    bool spawn_mode = use_spawn();
+
+    // forked stages would write out a copy of what is buffered
+    cout << flush;
+
+    // every stage joins the group of the first one
+    Job job;
+
+    for (size_t i = 0; i < n; i++, stage = arena[stage].next)
+    {
+        vector<Redirect> redirects;
+        AST_id command = open_redirects(arena, stage, redirects);
+        char** argv = command && arena[command].first ? get_argv(arena, command) : nullptr;
+
+        // resolve in the parent so the path cache outlives the child
+        string path;
+        bool external = argv && !is_builtin(argv[0]) && is_executable(argv[0], path);
+
+        pid_t pid = -1;
+
+        // a stage whose files failed to open fails on its own
+        if (!command)
+            ;
+        else if (external && spawn_mode)
+        {
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+
+            if (i > 0)
+                posix_spawn_file_actions_adddup2(&actions, pipes[i - 1][0], STDIN_FILENO);
+
+            if (i < n - 1)
+                posix_spawn_file_actions_adddup2(&actions, pipes[i][1], STDOUT_FILENO);
+
+            for (const auto& fds : pipes)
+            {
+                posix_spawn_file_actions_addclose(&actions, fds[0]);
+                posix_spawn_file_actions_addclose(&actions, fds[1]);
+            }
+
+            add_redirects(&actions, redirects);
+
+            pid = spawn(path, argv, &actions, job_control ? job.pgid : -1, job_control);
+
+            posix_spawn_file_actions_destroy(&actions);
+        }
+        else if ((pid = fork()) == 0)
+        {
+            if (job_control)
+                setpgid(0, job.pgid);
+
+            become_child();
+
+            if (i > 0)
+                dup2(pipes[i - 1][0], STDIN_FILENO);
+
+            if (i < n - 1)
+                dup2(pipes[i][1], STDOUT_FILENO);
+
+            for (const auto& fds : pipes)
+            {
+                close(fds[0]);
+                close(fds[1]);
+            }
+
+            apply_redirects(redirects);
+
+            if (!argv)
+                exit(EXIT_SUCCESS);
+
+            exec_and_exit(arena[command].count, argv);
+        }
+
+        close_redirects(redirects);
+
+        if (i > 0)
+            job.command += " | ";
+
+        job.command += join_argv(argv);
+        job.start(pid);
+
+        if (pid == -1)
+            continue;
+
+        if (job_control)
+        {
+            if (!job.pgid)
+                job.pgid = pid;
+
+            setpgid(pid, job.pgid);
+        }
+    }
+
+    for (const auto& fds : pipes)
+    {
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    return wait_foreground(move(job));
+}
+
+// the job runs in a forked copy of the shell, a lone command is
+// exec'd right there so the job is the program itself
+int Shell::execute_background(Arena& arena, AST_id background)
+{
+    AST_id tree = arena[background].first;
+
+    cout << flush;
+    cerr << flush;
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        cerr << name << ": fork failed\n";
+        return EXIT_FAILURE;
+    }
+
+    if (pid == 0)
+    {
+        if (job_control)
+            setpgid(0, 0);
+        else
+        {
+            // without job control it must not take input or ^C meant for the shell
+            int null = open("/dev/null", O_RDONLY);
+
+            dup2(null, STDIN_FILENO);
+            close(null);
+
+            signal(SIGINT, SIG_IGN);
+            signal(SIGQUIT, SIG_IGN);
+        }
+
+        become_child();
+        exec_tree_and_exit(arena, tree);
+    }
+
+    Job job;
+
+    if (job_control)
+    {
+        job.pgid = pid;
+        setpgid(pid, pid);
+    }
+
+    job.start(pid);
+    job.command = arena[background].data;
+
+    Job& added = jobs.add(move(job));
+
+    if (job_control)
+        cerr << "[" << added.id << "] " << pid << "\n";
+
+    vars.set("last_pid", to_string(pid));
+    pipestatus = { 0 };
+
+    return 0;
+}
+
+// waits for every process of a foreground job, which has the terminal
+// meanwhile, if it stops it goes in the table to be resumed by fg or bg
+int Shell::wait_foreground(Job job)
+{
+    bool owns_terminal = job_control && job.pgid;
+
+    if (owns_terminal)
+        tcsetpgrp(STDIN_FILENO, job.pgid);
+
+    // stages by pid, other children that change meanwhile are filed away
+    unordered_map<pid_t, size_t> stages;
+
+    for (size_t i = 0; i < job.pids.size(); i++)
+        if (job.statuses[i] == -1)
+            stages[job.pids[i]] = i;
+
+    while (job.state == Job::RUNNING && job.left > 0)
+    {
+        int status;
+        pid_t pid = next_child(true, status);
+
+        if (pid == -1)
+            break;
+
+        auto stage = stages.find(pid);
+
+        if (stage == stages.end())
+        {
+            jobs.file(pid, status);
+            continue;
+        }
+
+        // without job control nothing could resume it
+        if (WIFSTOPPED(status) && !job_control)
+            continue;
+
+        // it touched the terminal before it was handed over
+        if (WIFSTOPPED(status) && (WSTOPSIG(status) == SIGTTIN || WSTOPSIG(status) == SIGTTOU) && owns_terminal && tcgetpgrp(STDIN_FILENO) == job.pgid)
+        {
+            kill(pid, SIGCONT);
+            continue;
+        }
+
+        jobs.update(job, stage->second, status);
+    }
+
+    if (owns_terminal)
+    {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+        // programs that were cut short may have left the terminal in any state
+        if (job.state == Job::STOPPED || WIFSIGNALED(job.status))
+        {
+            job.has_modes = tcgetattr(STDIN_FILENO, &job.modes) == 0;
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_modes);
+        }
+        else
+            tcgetattr(STDIN_FILENO, &shell_modes);
+    }
+
+    if (job.state == Job::STOPPED)
+    {
+        job.notified = true;
+
+        Job& added = jobs.add(move(job));
+
+        cerr << "\n[" << added.id << "]" << jobs.mark(added) << "  " << describe(added) << "  " << added.command << "\n";
+
+        return 1;
+    }
+
+    pipestatus.clear();
+
+    for (int status : job.statuses)
+        pipestatus.push_back(status == -1 ? 0 : exit_code(status));
+
+    return exit_code(job.status);
+}
+
+// cpus this process may run on, which is what a pool should be sized to
+size_t cpu_count()
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        return CPU_COUNT(&set);
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+string fill_placeholder(string_view text, string_view input)
+{
+    string filled;
+    size_t pos;
+
+    while ((pos = text.find("{}")) != string_view::npos)
+    {
+        filled.append(text.substr(0, pos));
+        filled.append(input);
+        text.remove_prefix(pos + 2);
+    }
+
+    filled.append(text);
+
+    return filled;
+}
+
+bool has_placeholder(Arena& arena, AST_id tree)
+{
+    if ((arena[tree].type == AST::REGULAR || arena[tree].type == AST::SQ_STRING) && arena[tree].data.find("{}") != string_view::npos)
+        return true;
+
+    for (AST_id child = arena[tree].first; child; child = arena[child].next)
+        if (has_placeholder(arena, child))
+            return true;
+
+    return false;
+}
+
+void fill_tree(Arena& arena, AST_id tree, string_view input)
+{
+    if (arena[tree].type == AST::SQ_STRING && arena[tree].data.find("{}") != string_view::npos)
+        arena[tree].data = arena.store(fill_placeholder(arena[tree].data, input));
+
+    if (arena[tree].type != AST::WORD)
+    {
+        for (AST_id child = arena[tree].first; child; child = arena[child].next)
+            fill_tree(arena, child, input);
+
+        return;
+    }
+
+    // input in unquoted text goes in a quoted part of its own, so wildcards
+    // in it stay literal like they do for the words of a simple template
+    vector<AST_id> parts;
+
+    for (AST_id part = arena[tree].first; part; part = arena[part].next)
+        parts.push_back(part);
+
+    arena.clear_children(tree);
+
+    for (AST_id part : parts)
+    {
+        string_view text = arena[part].data;
+        size_t pos;
+
+        arena[part].next = 0;
+
+        if (arena[part].type != AST::REGULAR || text.find("{}") == string_view::npos)
+        {
+            fill_tree(arena, part, input);
+            arena.append(tree, part);
+            continue;
+        }
+
+        while ((pos = text.find("{}")) != string_view::npos)
+        {
+            if (pos > 0)
+                arena.append(tree, arena.make(AST::REGULAR, text.substr(0, pos)));
+
+            arena.append(tree, arena.make(AST::SQ_STRING, arena.store(input)));
+            text.remove_prefix(pos + 2);
+        }
+
+        if (!text.empty())
+            arena.append(tree, arena.make(AST::REGULAR, text));
+    }
+}
+
+// the lone command of a simple template comes as words expanded once, it is
+// spawned from argv built here, anything else runs in a forked copy of the shell
+// that fills in its own copy of the tree
+void Shell::start_task(Arena& arena, AST_id tree, const vector<string>* words, const string& input, ParallelTask& task)
+{
+    vector<string> args;
+    vector<char*> argv;
+
+    if (words)
+    {
+        for (const string& word : *words)
+            args.push_back(fill_placeholder(word, input));
+
+        for (string& arg : args)
+            argv.push_back(arg.data());
+
+        argv.push_back(nullptr);
+
+        // pure builtins run right here like they do for substitutions
+        if (pure_builtins.find(args[0]) != pure_builtins.end())
+        {
+            ostringstream out, err;
+            streambuf* old_out = cout.rdbuf(out.rdbuf());
+            streambuf* old_err = cerr.rdbuf(err.rdbuf());
+
+            task.status = builtins[args[0]](args.size(), argv.data());
+
+            cout.rdbuf(old_out);
+            cerr.rdbuf(old_err);
+
+            task.output = out.str();
+            task.errors = err.str();
+
+            return;
+        }
+    }
+
+    int out[2], err[2];
+
+    if (pipe2(out, O_CLOEXEC) == -1)
+    {
+        task.status = EXIT_FAILURE;
+        task.errors = "parallel: pipe failed\n";
+        return;
+    }
+
+    if (pipe2(err, O_CLOEXEC) == -1)
+    {
+        close(out[0]);
+        close(out[1]);
+
+        task.status = EXIT_FAILURE;
+        task.errors = "parallel: pipe failed\n";
+        return;
+    }
+
+    string path;
+
+    if (words && use_spawn() && !is_builtin(args[0]) && is_executable(args[0], path))
+    {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+        task.pid = spawn(path, argv.data(), &actions, -1, job_control);
+
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    else
+    {
+        cout << flush;
+        cerr << flush;
+        fflush(stdout);
+
+        task.pid = fork();
+
+        if (task.pid == 0)
+        {
+            int null = open("/dev/null", O_RDONLY);
+
+            dup2(null, STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            dup2(err[1], STDERR_FILENO);
+
+            become_child();
+
+            if (words)
+                exec_and_exit(args.size(), argv.data());
+
+            try
+            {
+                fill_tree(arena, tree, input);
+                make_regular(arena, tree);
+                sub_commands(arena, tree);
+            }
+            catch (const runtime_error& e)
+            {
+                cerr << name << ": " << e.what() << endl;
+                exit(EXIT_FAILURE);
+            }
+
+            exec_tree_and_exit(arena, tree);
+        }
+    }
+
+    close(out[1]);
+    close(err[1]);
+
+    if (task.pid == -1)
+    {
+        close(out[0]);
+        close(err[0]);
+
+        task.status = EXIT_FAILURE;
+        return;
+    }
+
+    task.out = out[0];
+    task.err = err[0];
+}
+
+bool Shell::use_spawn()
+{
+    string launch;
+
+    return !vars.get("launch", launch) || launch != "fork";
+}
+
+bool Shell::is_builtin(const string& name)
+{
+    return builtins.find(name) != builtins.end();
+}
+
+bool absolute_or_relative(const string& name)
+{
+    return name.find('/') != string::npos;
+}
+
+bool Shell::is_executable(const string& name, string& path)
+{
+    if (absolute_or_relative(name))
+    {
+        struct stat file_stat;
+
+        path = name;
+
+        return (stat(name.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode) && (file_stat.st_mode & S_IXUSR));
+    }
+
+    return commands.find(name, path);
+}
+
+int Shell::exec_and_return(int argc, char** argv, const vector<Redirect>& redirects)
+{
+    string path;
+    bool builtin = is_builtin(argv[0]);
+
+    if (builtin || !is_executable(argv[0], path))
+    {
+        vector<pair<int, int>> saved;
+        int status = EXIT_FAILURE;
+
+        if (!redirects.empty())
+            swap_fds(redirects, saved);
+
+        try
+        {
+            if (builtin)
+            {
+                // fg sets it for the job it waited for
+                pipestatus.clear();
+
+                status = builtins[argv[0]](argc, argv);
+
+                if (pipestatus.empty())
+                    pipestatus = { status };
+            }
+            else
+                cerr << argv[0] << ": command not found\n";
+        }
+        catch (...)
+        {
+            if (!redirects.empty())
+                restore_fds(saved);
+
+            throw;
+        }
+
+        if (!redirects.empty())
+            restore_fds(saved);
+
+        return status;
+    }
+
+    pid_t pid;
+
+    // builtin output buffered so far has to come first
+    cout << flush;
+
+    if (use_spawn())
+    {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+
+        add_redirects(&actions, redirects);
+
+        pid = spawn(path, argv, &actions, job_control ? 0 : -1, job_control);
+
+        posix_spawn_file_actions_destroy(&actions);
+
+        if (pid == -1)
+            return EXIT_FAILURE;
+    }
+    else if ((pid = fork()) == 0)
+    {
+        if (job_control)
+            setpgid(0, 0);
+
+        become_child();
+        apply_redirects(redirects);
+
+        exec_file(path, argv);
+        cerr << name << ": exec and return failed\n";
+        exit(EXIT_FAILURE);
+    }
+
+    Job job;
+
+    if (job_control)
+    {
+        job.pgid = pid;
+        setpgid(pid, pid);
+    }
+
+    job.start(pid);
+    job.command = join_argv(argv);
+
+    return wait_foreground(move(job));
+}
+
+void Shell::exec_and_exit(int argc, char** argv)
+{
+    if (is_builtin(argv[0]))
+        exit(builtins[argv[0]](argc, argv));
+
+    string path;
+
+    if (is_executable(argv[0], path))
+    {
+        exec_file(path, argv);
+        cerr << name << ": exec and exit failed\n";
+        exit(EXIT_FAILURE);
+    }
+
+    cerr << argv[0] << ": command not found\n";
+
+    exit(EXIT_FAILURE);
+}
+
+// for a forked copy of the shell, a lone command replaces it right away
+void Shell::exec_tree_and_exit(Arena& arena, AST_id tree)
+{
+    if (arena[tree].type != AST::COMMAND && arena[tree].type != AST::REDIRECT)
+        exit(execute_tree(arena, tree));
+
+    vector<Redirect> redirects;
+    AST_id command = open_redirects(arena, tree, redirects);
+
+    if (!command)
+        exit(EXIT_FAILURE);
+
+    apply_redirects(redirects);
+
+    if (!arena[command].first)
+        exit(EXIT_SUCCESS);
+
+    exec_and_exit(arena[command].count, get_argv(arena, command));
+}
+
+int Shell::__exit(int argc, char** argv)
+{
+    if (argc > 2)
+    {
+        cerr << "exit: too many arguments\n";
+        return 1;
+    }
+
+    int status = 0;
+
+    if (argc == 2)
+    {
+        try
+        {
+            status = stoi(argv[1]);
+        }
+        catch (...)
+        {
+            cerr << "exit: status is invalid\n";
+            return 1;
+        }
+    }
+
+    exit(status);
+}
+
+int Shell::__cd(int argc, char** argv)
+{
+    if (argc > 2)
+    {
+        cerr << "cd: too many arguments\n";
+        return 1;
+    }
+
+    char* path;
+
+    if (argc == 1)
+    {
+        path = getenv("HOME");
+
+        if (!path)
+        {
+            cerr << "cd: $HOME is not defined\n";
+            return 1;
+        }
+    }
+    else
+        path = argv[1];
+
+    if (chdir(path) == -1)
+    {
+        perror("cd");
+        return 1;
+    }
+
+    char* pwd = getcwd(nullptr, 0);
+
+    vars.set("PWD", string(pwd));
+
+    free(pwd);
+
+    return 0;
+}
+
+int Shell::__set(int argc, char** argv)
+{
+    if (argc > 3)
+    {
+        cerr << "set: too many arguments\n";
+        return 1;
+    }
+
+    if (argc == 1)
+    {
+        for (const auto& pair : vars.data)
+            if (!vars.is_exported(pair.first))
+                cout << pair.first << " = " << pair.second << "\e[0m\n";
+    }
+    else if (argc == 2)
+        vars.set(argv[1], "");
+    else if (argc == 3)
+        vars.set(argv[1], argv[2]);
+
+    return 0;
+}
+
+int Shell::__unset(int argc, char** argv)
+{
+    if (argc == 2)
+        return !vars.unset(argv[1]);
+
+    return 0;
+}
+
+int Shell::__export(int argc, char** argv)
+{
+    if (argc == 2)
+        return !vars.export_(argv[1]);
+
+    return 0;
+}
+
+int Shell::__alias(int argc, char** argv)
+{
+    if (argc > 3)
+    {
+        cerr << "alias: too many arguments\n";
+        return 1;
+    }
+
+    if (argc == 1)
+    {
+        for (const auto& pair : aliases.data)
+            cout << pair.first << " = " << pair.second << "\n";
+    }
+    else if (argc == 2)
+        aliases.set(argv[1], "");
+    else if (argc == 3)
+        aliases.set(argv[1], argv[2]);
+
+    return 0;
+}
+
+int Shell::__unalias(int argc, char** argv)
+{
+    if (argc == 2)
+        return !aliases.unset(argv[1]);
+
+    return 0;
+}
+
+int Shell::__history(int argc, char** argv)
+{
+    if (argc == 1)
+    {
+        int max_size = to_string(history.size()).size();
+
+        for (size_t i = 0; i < history.size(); i++)
+        {
+            string num = to_string(history.size() - i);
+            num = string(max_size - num.size(), ' ') + num;
+
+            cout << "  " << num << "  " << history[i] << endl;
+        }
+    }
+    else if (argc == 2 && string(argv[1]) == "-c")
+        history.clear();
+
+    return 0;
+}
+
+int Shell::__hash(int argc, char** argv)
+{
+    if (argc == 1)
+    {
+        for (const auto& pair : commands.data)
+            cout << pair.first << " = " << pair.second << "\n";
+
+        return 0;
+    }
+
+    if (argc == 2 && string(argv[1]) == "-r")
+    {
+        commands.clear();
+        return 0;
+    }
+
+    int status = 0;
+    string path;
+
+    for (int i = 1; i < argc; i++)
+        if (!commands.find(argv[i], path))
+        {
+            cerr << "hash: " << argv[i] << ": not found\n";
+            status = 1;
+        }
+
+    return status;
+}
+
+int Shell::__suggestions(int argc, char**)
+{
+    if (argc > 1)
+    {
+        cerr << "suggestions: too many arguments\n";
+        return 1;
+    }
+
+    const Suggester& sug = input.suggester;
+
+    cout << "requests = " << sug.requests << "\n";
+    cout << "late = " << sug.late << "\n";
+    cout << "dropped = " << sug.dropped << "\n";
+
+    return 0;
+}
+
+void utf8_encode(uint32_t code, string& out)
+{
+    if (code < 0x80)
+        out += static_cast<char>(code);
+    else if (code < 0x800)
+    {
+        out += static_cast<char>(0xc0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+        out += static_cast<char>(0xe0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+    else
+    {
+        out += static_cast<char>(0xf0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (code & 0x3f));
+    }
+}
+
+// one backslash escape starting at str[i], left on its last character
+// printf formats take octal as \NNN, %b and echo -e as \0NNN
+// returns false for \c, which ends all output
+bool unescape_one(string_view str, size_t& i, string& out, bool zero_octal)
+{
+    if (i + 1 == str.size())
+    {
+        out += '\\';
+        return true;
+    }
+
+    char c = str[++i];
+
+    switch (c)
+    {
+    case '\\':  out += '\\';    return true;
+    case 'a':   out += '\a';    return true;
+    case 'b':   out += '\b';    return true;
+    case 'c':                   return false;
+    case 'e':   out += '\e';    return true;
+    case 'f':   out += '\f';    return true;
+    case 'n':   out += '\n';    return true;
+    case 'r':   out += '\r';    return true;
+    case 't':   out += '\t';    return true;
+    case 'v':   out += '\v';    return true;
+    }
+
+    size_t max = 0;
+    int base = 16;
+
+    if (c == 'x')
+        max = 2;
+    else if (c == 'u')
+        max = 4;
+    else if (c == 'U')
+        max = 8;
+    else if (c >= '0' && c <= '7')
+    {
+        base = 8;
+        max = 3;
+
+        if (zero_octal && c == '0')
+            i++;
+    }
+
+    if (base == 16)
+        i++;
+
+    size_t start = i;
+    uint32_t value = 0;
+
+    while (i < str.size() && i - start < max && (base == 8 ? str[i] >= '0' && str[i] <= '7' : isxdigit(static_cast<unsigned char>(str[i]))))
+    {
+        value = value * base + (isdigit(str[i]) ? str[i] - '0' : tolower(str[i]) - 'a' + 10);
+        i++;
+    }
+
+    // no digits, the backslash stays as it is
+    if (max == 0 || (i == start && base == 16))
+    {
+        i = start - (base == 16 ? 1 : 0);
+        out += '\\';
+        out += str[i];
+        return true;
+    }
+
+    i--;
+
+    if (c == 'u' || c == 'U')
+        utf8_encode(value, out);
+    else
+        out += static_cast<char>(value);
+
+    return true;
+}
+
+bool unescape(string_view str, string& out, bool zero_octal)
+{
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        if (str[i] != '\\')
+            out += str[i];
+        else if (!unescape_one(str, i, out, zero_octal))
+            return false;
+    }
+
+    return true;
+}
+
+// printf numbers, 'c and "c stand for the code of c
+template <typename T>
+T printf_number(const char* arg, T (*convert)(const char*, char**), int& status)
+{
+    if (*arg == '\'' || *arg == '"')
+        return static_cast<unsigned char>(arg[1]);
+
+    if (*arg == '\0')
+        return 0;
+
+    char* end;
+
+    errno = 0;
+    T value = convert(arg, &end);
+
+    if (end == arg)
+    {
+        cerr << "printf: '" << arg << "': expected a numeric value\n";
+        status = 1;
+    }
+    else if (errno == ERANGE)
+    {
+        cerr << "printf: '" << arg << "': " << strerror(errno) << "\n";
+        status = 1;
+    }
+    else if (*end)
+    {
+        cerr << "printf: '" << arg << "': value not completely converted\n";
+        status = 1;
+    }
+
+    return value;
+}
+
+intmax_t to_intmax(const char* str, char** end) { return strtoimax(str, end, 0); }
+uintmax_t to_uintmax(const char* str, char** end) { return strtoumax(str, end, 0); }
+long double to_long_double(const char* str, char** end) { return strtold(str, end); }
+
+template <typename T>
+void printf_append(string& out, const string& spec, T value)
+{
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf), spec.c_str(), value);
+
+    if (len < 0)
+        return;
+
+    if (static_cast<size_t>(len) < sizeof(buf))
+    {
+        out.append(buf, len);
+        return;
+    }
+
+    string big(len + 1, '\0');
+    snprintf(big.data(), big.size(), spec.c_str(), value);
+    out.append(big.data(), len);
+}
+
+// goes through the format once, false when output has to stop
+bool printf_format(string_view format, int argc, char** argv, int& arg, string& out, int& status)
+{
+    auto next_arg = [&]() -> const char* { return arg < argc ? argv[arg++] : ""; };
+
+    for (size_t i = 0; i < format.size(); i++)
+    {
+        if (format[i] == '\\')
+        {
+            if (!unescape_one(format, i, out, false))
+                return false;
+
+            continue;
+        }
+
+        if (format[i] != '%')
+        {
+            out += format[i];
+            continue;
+        }
+
+        size_t start = i++;
+
+        if (i < format.size() && format[i] == '%')
+        {
+            out += '%';
+            continue;
+        }
+
+        string spec = "%";
+
+        while (i < format.size() && string_view("-+ #0'").find(format[i]) != string_view::npos)
+            spec += format[i++];
+
+        // * takes the width or precision from the arguments
+        for (int part = 0; part < 2; part++)
+        {
+            if (part == 1)
+            {
+                if (i == format.size() || format[i] != '.')
+                    break;
+
+                spec += format[i++];
+            }
+
+            if (i < format.size() && format[i] == '*')
+            {
+                spec += to_string(printf_number(next_arg(), to_intmax, status));
+                i++;
+            }
+            else
+                while (i < format.size() && isdigit(format[i]))
+                    spec += format[i++];
+        }
+
+        while (i < format.size() && string_view("hlLqjzt").find(format[i]) != string_view::npos)
+            i++;
+
+        char conv = i < format.size() ? format[i] : '\0';
+
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+            printf_append(out, spec + "j" + conv, printf_number(next_arg(), to_intmax, status));
+            break;
+
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            printf_append(out, spec + "j" + conv, printf_number(next_arg(), to_uintmax, status));
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            printf_append(out, spec + "L" + conv, printf_number(next_arg(), to_long_double, status));
+            break;
+
+        case 'c':
+            printf_append(out, spec + "c", static_cast<int>(static_cast<unsigned char>(*next_arg())));
+            break;
+
+        case 's':
+            printf_append(out, spec + "s", next_arg());
+            break;
+
+        case 'b':
+        {
+            string text;
+            bool more = unescape(next_arg(), text, true);
+
+            printf_append(out, spec + "s", text.c_str());
+
+            if (!more)
+                return false;
+
+            break;
+        }
+
+        default:
+            cerr << "printf: " << format.substr(start, i + 1 - start) << ": invalid conversion specification\n";
+            status = 1;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int Shell::__printf(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        cerr << "printf: missing operand\n";
+        return 1;
+    }
+
+    string out;
+    int arg = 2;
+    int status = 0;
+
+    // the format is used again for arguments it left over
+    while (true)
+    {
+        int before = arg;
+
+        if (!printf_format(argv[1], argc, argv, arg, out, status))
+            break;
+
+        if (arg == before || arg >= argc)
+            break;
+    }
+
+    cout << out;
+
+    return status;
+}
+
+int Shell::__echo(int argc, char** argv)
+{
+    bool newline = true;
+    bool escapes = false;
+    int i = 1;
+
+    // an argument is an option only if every letter is one
+    for (; i < argc; i++)
+    {
+        string_view arg = argv[i];
+
+        if (arg.size() < 2 || arg[0] != '-' || arg.find_first_not_of("neE", 1) != string_view::npos)
+            break;
+
+        for (char c : arg.substr(1))
+        {
+            if (c == 'n')
+                newline = false;
+            else
+                escapes = c == 'e';
+        }
+    }
+
+    string out;
+
+    for (int first = i; i < argc; i++)
+    {
+        if (i > first)
+            out += ' ';
+
+        if (!escapes)
+            out += argv[i];
+        else if (!unescape(argv[i], out, true))
+        {
+            cout << out;
+            return 0;
+        }
+    }
+
+    if (newline)
+        out += '\n';
+
+    cout << out;
+
+    return 0;
+}
+
+int Shell::__true(int, char**)
+{
+    return 0;
+}
+
+int Shell::__false(int, char**)
+{
+    return 1;
+}
+
+// expressions for test and [, ! binds tighter than -a, -a tighter than -o
+struct TestExpr
+{
+    vector<string_view> args;
+    size_t pos = 0;
+
+    bool parse_or();
+    bool parse_and();
+    bool parse_not();
+    bool parse_primary();
+};
+
+bool is_unary_test(string_view op)
+{
+    return op.size() == 2 && op[0] == '-' && string_view("bcdefghkLnprsStuwxzOG").find(op[1]) != string_view::npos;
+}
+
+bool is_binary_test(string_view op)
+{
+    static const unordered_set<string_view> ops = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef" };
+
+    return ops.find(op) != ops.end();
+}
+
+intmax_t test_integer(string_view arg)
+{
+    string str(arg);
+    char* end;
+
+    errno = 0;
+    intmax_t value = strtoimax(str.c_str(), &end, 10);
+
+    while (isspace(*end))
+        end++;
+
+    if (str.empty() || end == str.c_str() || *end || errno == ERANGE)
+        throw runtime_error("invalid integer '" + str + "'");
+
+    return value;
+}
+
+bool test_unary(char op, string_view arg)
+{
+    if (op == 'n')
+        return !arg.empty();
+
+    if (op == 'z')
+        return arg.empty();
+
+    string path(arg);
+
+    if (op == 't')
+        return isatty(static_cast<int>(test_integer(arg)));
+
+    if (op == 'r' || op == 'w' || op == 'x')
+        return access(path.c_str(), op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK) == 0;
+
+    struct stat st;
+
+    if ((op == 'h' || op == 'L' ? lstat(path.c_str(), &st) : stat(path.c_str(), &st)) == -1)
+        return false;
+
+    switch (op)
+    {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'e': return true;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return st.st_mode & S_ISGID;
+    case 'h':
+    case 'L': return S_ISLNK(st.st_mode);
+    case 'k': return st.st_mode & S_ISVTX;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return st.st_mode & S_ISUID;
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    }
+
+    return false;
+}
+
+bool test_binary(string_view left, string_view op, string_view right)
+{
+    if (op == "=" || op == "==")    return left == right;
+    if (op == "!=")                 return left != right;
+    if (op == "<")                  return left < right;
+    if (op == ">")                  return left > right;
+
+    if (op == "-nt" || op == "-ot" || op == "-ef")
+    {
+        struct stat l, r;
+        bool has_l = stat(string(left).c_str(), &l) == 0;
+        bool has_r = stat(string(right).c_str(), &r) == 0;
+
+        if (op == "-ef")
+            return has_l && has_r && l.st_dev == r.st_dev && l.st_ino == r.st_ino;
+
+        if (op == "-ot")
+        {
+            swap(l, r);
+            swap(has_l, has_r);
+        }
+
+        if (!has_l)
+            return false;
+
+        if (!has_r)
+            return true;
+
+        return l.st_mtim.tv_sec != r.st_mtim.tv_sec ? l.st_mtim.tv_sec > r.st_mtim.tv_sec : l.st_mtim.tv_nsec > r.st_mtim.tv_nsec;
+    }
+
+    intmax_t a = test_integer(left);
+    intmax_t b = test_integer(right);
+
+    if (op == "-eq")    return a == b;
+    if (op == "-ne")    return a != b;
+    if (op == "-lt")    return a < b;
+    if (op == "-le")    return a <= b;
+    if (op == "-gt")    return a > b;
+
+    return a >= b;
+}
+
+bool TestExpr::parse_or()
+{
+    bool res = parse_and();
+
+    while (pos < args.size() && args[pos] == "-o")
+    {
+        pos++;
+        res = parse_and() || res;
+    }
+
+    return res;
+}
+
+bool TestExpr::parse_and()
+{
+    bool res = parse_not();
+
+    while (pos < args.size() && args[pos] == "-a")
+    {
+        pos++;
+        res = parse_not() && res;
+    }
+
+    return res;
+}
+
+bool TestExpr::parse_not()
+{
+    if (pos + 1 < args.size() && args[pos] == "!")
+    {
+        pos++;
+        return !parse_not();
+    }
+
+    return parse_primary();
+}
+
+bool TestExpr::parse_primary()
+{
+    if (pos >= args.size())
+        throw runtime_error("argument expected");
+
+    // an operator in the middle wins, so -n = -n compares strings
+    if (pos + 2 < args.size() && is_binary_test(args[pos + 1]))
+    {
+        pos += 3;
+        return test_binary(args[pos - 3], args[pos - 2], args[pos - 1]);
+    }
+
+    if (args[pos] == "(" && pos + 1 < args.size())
+    {
+        pos++;
+
+        bool res = parse_or();
+
+        if (pos >= args.size() || args[pos] != ")")
+            throw runtime_error("')' expected");
+
+        pos++;
+
+        return res;
+    }
+
+    if (is_unary_test(args[pos]) && pos + 1 < args.size())
+    {
+        pos += 2;
+        return test_unary(args[pos - 2][1], args[pos - 1]);
+    }
+
+    return !args[pos++].empty();
+}
+
+int Shell::__test(int argc, char** argv)
+{
+    string name = argv[0];
+
+    if (name == "[")
+    {
+        if (string(argv[argc - 1]) != "]")
+        {
+            cerr << "[: missing ']'\n";
+            return 2;
+        }
+
+        argc--;
+    }
+
+    TestExpr expr;
+
+    for (int i = 1; i < argc; i++)
+        expr.args.push_back(argv[i]);
+
+    if (expr.args.empty())
+        return 1;
+
+    try
+    {
+        bool res = expr.parse_or();
+
+        if (expr.pos + 1 == expr.args.size())
+            throw runtime_error("missing argument after '" + string(expr.args[expr.pos]) + "'");
+
+        if (expr.pos < expr.args.size())
+            throw runtime_error("extra argument '" + string(expr.args[expr.pos]) + "'");
+
+        return res ? 0 : 1;
+    }
+    catch (const runtime_error& e)
+    {
+        cerr << name << ": " << e.what() << "\n";
+        return 2;
+    }
+}
+
+// prints the output of a command line, run only the first time it is
+// asked for with this key, entries are files so separate shells share them
+// the oldest entries are dropped past this many
+static const size_t MEMO_ENTRIES = 256;
+
+// keeps the newest MEMO_ENTRIES files of the memo folder
+void evict_memos(const string& dir)
+{
+    DIR* handle = opendir(dir.c_str());
+
+    if (!handle)
+        return;
+
+    vector<pair<time_t, string>> entries;
+    dirent* entry;
+
+    while ((entry = readdir(handle)) != NULL)
+    {
+        struct stat st;
+        string path = dir + "/" + entry->d_name;
+
+        if (entry->d_name[0] != '.' && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            entries.push_back({ st.st_mtime, path });
+    }
+
+    closedir(handle);
+
+    if (entries.size() <= MEMO_ENTRIES)
+        return;
+
+    sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size() - MEMO_ENTRIES; i++)
+        unlink(entries[i].second.c_str());
+}
+
+// an entry is used for ttl seconds after it was written, since the
+// output may depend on more than the key, failed commands are not kept
+int Shell::__memo(int argc, char** argv)
+{
+    long ttl = 10;
+    int i = 1;
+
+    if (i + 1 < argc && strcmp(argv[i], "-t") == 0)
     {
-        cerr << "alias: too many arguments\n";
+        char* end;
+
+        ttl = strtol(argv[i + 1], &end, 10);
+
+        if (*argv[i + 1] == '\0' || *end != '\0' || ttl < 0)
+        {
+            cerr << "memo: invalid ttl '" << argv[i + 1] << "'\n";
+            return 1;
+        }
+
+        i += 2;
+    }
+
+    if (argc - i != 2)
+    {
+        cerr << "memo: usage: memo [-t seconds] key command\n";
         return 1;
     }
 
-    if (argc == 1)
+    string key = string(argv[i]) + '\0' + argv[i + 1] + '\0';
+    string path = cache_path("memo", key);
+    struct stat st;
+
+    if (!path.empty() && stat(path.c_str(), &st) == 0 && time(nullptr) - st.st_mtime < ttl)
     {
-        for (const auto& pair : aliases.data)
-            cout << pair.first << " = " << pair.second << "\n";
+        ifstream cached(path, ios::binary);
+        string entry((istreambuf_iterator<char>(cached)), istreambuf_iterator<char>());
+
+        // the key is stored too, two keys might share a file name
+        if (entry.compare(0, key.size(), key) == 0)
+        {
+            cout << string_view(entry).substr(key.size());
+            return 0;
+        }
     }
-    else if (argc == 2)
-        aliases.set(argv[1], "");
-    else if (argc == 3)
-        aliases.set(argv[1], argv[2]);
+
+    int status;
+    string value = capture(argv[i + 1], status);
+
+    cout << value;
+
+    if (path.empty() || status != 0)
+        return status;
+
+    string temp = path + "." + to_string(getpid());
+    ofstream file(temp, ios::binary);
+
+    file << key << value;
+    file.close();
+
+    if (file)
+        rename(temp.c_str(), path.c_str());
+    else
+        unlink(temp.c_str());
+
+    evict_memos(path.substr(0, path.rfind('/')));
 
     return 0;
 }
 
-int Shell::__unalias(int argc, char** argv)
+int Shell::__jobs(int argc, char** argv)
 {
-    if (argc == 2)
-        return !aliases.unset(argv[1]);
+    bool pids = false;
+    bool long_format = false;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++)
+    {
+        for (const char* opt = argv[i] + 1; *opt; opt++)
+        {
+            if (*opt == 'l')
+                long_format = true;
+            else if (*opt == 'p')
+                pids = true;
+            else
+            {
+                cerr << "jobs: invalid option '" << *opt << "'\n";
+                return 1;
+            }
+        }
+    }
+
+    take_children();
+    jobs.reap();
+
+    vector<Job*> selected;
+
+    if (i == argc)
+        for (Job& job : jobs.list)
+            selected.push_back(&job);
+
+    for (; i < argc; i++)
+    {
+        Job* job = jobs.find(argv[i]);
+
+        if (!job)
+        {
+            cerr << "jobs: no such job '" << argv[i] << "'\n";
+            return 1;
+        }
+
+        selected.push_back(job);
+    }
+
+    for (Job* job : selected)
+    {
+        pid_t leader = job->pgid ? job->pgid : job->pids.back();
+
+        if (pids)
+        {
+            cout << leader << "\n";
+            continue;
+        }
+
+        cout << "[" << job->id << "]" << jobs.mark(*job) << "  ";
+
+        if (long_format)
+            cout << leader << "  ";
+
+        cout << describe(*job) << "  " << job->command << "\n";
+
+        if (job->state != Job::RUNNING)
+            job->notified = true;
+    }
 
     return 0;
 }
 
-int Shell::__history(int argc, char** argv)
+// finds the job fg and bg act on, complaining like they would
+Job* find_job(Jobs& jobs, const char* builtin, const char* spec, bool job_control)
+{
+    if (!job_control)
+    {
+        cerr << builtin << ": no job control\n";
+        return nullptr;
+    }
+
+    Job* job = jobs.find(spec ? spec : "");
+
+    if (!job)
+    {
+        if (spec)
+            cerr << builtin << ": no such job '" << spec << "'\n";
+        else
+            cerr << builtin << ": no current job\n";
+
+        return nullptr;
+    }
+
+    // started before job control was on, it has no group to signal
+    if (!job->pgid)
+    {
+        cerr << builtin << ": job " << job->id << " has no process group\n";
+        return nullptr;
+    }
+
+    return job;
+}
+
+int Shell::__fg(int argc, char** argv)
+{
+    if (argc > 2)
+    {
+        cerr << "fg: too many arguments\n";
+        return 1;
+    }
+
+    take_children();
+    jobs.reap();
+
+    Job* found = find_job(jobs, "fg", argc == 2 ? argv[1] : nullptr, job_control);
+
+    if (!found)
+        return 1;
+
+    Job job = move(*found);
+
+    jobs.remove(job.id);
+
+    if (job.state == Job::DONE)
+        return exit_code(job.status);
+
+    cout << job.command << endl;
+
+    if (job.has_modes)
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &job.modes);
+
+    // it has to own the terminal before it runs again
+    tcsetpgrp(STDIN_FILENO, job.pgid);
+
+    if (job.state == Job::STOPPED)
+    {
+        job.state = Job::RUNNING;
+        kill(-job.pgid, SIGCONT);
+    }
+
+    return wait_foreground(move(job));
+}
+
+int Shell::__bg(int argc, char** argv)
+{
+    take_children();
+    jobs.reap();
+
+    for (int i = 1; i < max(argc, 2); i++)
+    {
+        Job* job = find_job(jobs, "bg", i < argc ? argv[i] : nullptr, job_control);
+
+        if (!job)
+            return 1;
+
+        if (job->state == Job::STOPPED)
+        {
+            job->state = Job::RUNNING;
+            kill(-job->pgid, SIGCONT);
+        }
+
+        cout << "[" << job->id << "]" << jobs.mark(*job) << "  " << job->command << " &\n";
+    }
+
+    return 0;
+}
+
+// waits for the given jobs or all of them, the status is the last one's,
+// a job that is or gets stopped is not waited for
+int Shell::__wait(int argc, char** argv)
 {
+    vector<int> ids;
+
     if (argc == 1)
+        for (const Job& job : jobs.list)
+            ids.push_back(job.id);
+
+    for (int i = 1; i < argc; i++)
     {
-        int max_size = to_string(history.size()).size();
+        Job* job = jobs.find(argv[i]);
 
-        for (size_t i = 0; i < history.size(); i++)
+        if (!job)
         {
-            string num = to_string(history.size() - i);
-            num = string(max_size - num.size(), ' ') + num;
+            cerr << "wait: no such job '" << argv[i] << "'\n";
+            return 127;
+        }
 
-            cout << "  " << num << "  " << history[i] << endl;
+        ids.push_back(job->id);
+    }
+
+    int status = 0;
+
+    for (int id : ids)
+    {
+        Job* job = jobs.find("%" + to_string(id));
+
+        if (!job)
+            continue;
+
+        while (job->state == Job::RUNNING && job->left > 0)
+        {
+            int raw;
+            pid_t pid = next_child(true, raw);
+
+            if (pid == -1)
+                break;
+
+            jobs.file(pid, raw);
         }
+
+        if (job->state == Job::STOPPED)
+        {
+            status = 1;
+            continue;
+        }
+
+        status = exit_code(job->status);
+        jobs.remove(id);
     }
-    else if (argc == 2 && string(argv[1]) == "-c")
-        history.clear();
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
+
+// runs a command template once per input with up to one task per cpu,
+// {} stands for the input or else it goes last, outputs come in input order,
+// the status is the number of tasks that failed, at most 101
+int Shell::__parallel(int argc, char** argv)
+{
+    size_t slots = cpu_count();
+    int i = 1;
+
+    if (i + 1 < argc && strcmp(argv[i], "-j") == 0)
+    {
+        try
+        {
+            slots = stoul(argv[i + 1]);
+        }
+        catch (...)
+        {
+            cerr << "parallel: invalid job count '" << argv[i + 1] << "'\n";
+            return 2;
+        }
+
+        if (slots == 0)
+            slots = cpu_count();
+
+        i += 2;
+    }
+
+    if (i >= argc)
+    {
+        cerr << "parallel: usage: parallel [-j jobs] command [input ...]\n";
+        return 2;
+    }
+
+    string command = argv[i++];
+    string_view cursor = command;
+    Arena& arena = acquire_arena();
+    AST_id tree = 0;
+
+    // inputs are the arguments, without any they are lines of stdin read as they come
+    deque<string> inputs(argv + i, argv + argc);
+    bool reading = i == argc;
+    string partial;
+
+    vector<string> words;
+    bool simple = false;
+
+    try
+    {
+        tree = parse_shell_input(arena, cursor);
+
+        if (tree && !has_placeholder(arena, tree))
+        {
+            AST_id last = tree;
+
+            while (arena[last].type != AST::COMMAND)
+                last = arena[last].type == AST::REDIRECT ? arena[last].first : arena[last].last;
+
+            AST_id word = arena.make(AST::WORD);
+
+            arena.append(word, arena.make(AST::REGULAR, "{}"));
+            arena.append(last, word);
+        }
+
+        vector<Substitution> subs;
+
+        if (tree)
+            find_substitutions(arena, tree, subs);
+
+        // nothing in it depends on running anything, so it is expanded once
+        simple = tree && arena[tree].type == AST::COMMAND && subs.empty();
+
+        if (simple)
+        {
+            make_regular(arena, tree);
+            sub_commands(arena, tree);
+
+            for (AST_id word = arena[tree].first; word; word = arena[word].next)
+                words.emplace_back(arena[word].data);
+        }
+    }
+    catch (const runtime_error& e)
+    {
+        report_error(command, command.size() - cursor.size(), e);
+        release_arena();
+        return 2;
+    }
+
+    if (!tree || (simple && words.empty()))
+    {
+        release_arena();
+        return 0;
+    }
+
+    deque<ParallelTask> window;
+    size_t running = 0;
+    size_t failed = 0;
+
+    while (true)
+    {
+        while (running < slots && !inputs.empty())
+        {
+            window.emplace_back();
+            start_task(arena, tree, simple ? &words : nullptr, inputs.front(), window.back());
+            inputs.pop_front();
+
+            if (window.back().pid > 0)
+                running++;
+        }
+
+        // the oldest task's output goes out as it comes, the rest waits
+        while (!window.empty())
+        {
+            ParallelTask& head = window.front();
+
+            cout << head.output << flush;
+            cerr << head.errors;
+
+            head.output.clear();
+            head.errors.clear();
+
+            if (head.status == -1)
+                break;
+
+            if (head.status != 0)
+                failed++;
+
+            window.pop_front();
+        }
+
+        if (window.empty() && inputs.empty() && !reading)
+            break;
+
+        vector<pollfd> fds;
+        vector<ParallelTask*> owners;
+
+        for (auto& task : window)
+        {
+            if (task.out != -1)
+            {
+                fds.push_back({ task.out, POLLIN, 0 });
+                owners.push_back(&task);
+            }
+
+            if (task.err != -1)
+            {
+                fds.push_back({ task.err, POLLIN, 0 });
+                owners.push_back(&task);
+            }
+        }
+
+        // inputs are only read ahead as far as there are slots to fill
+        if (reading && inputs.size() < slots)
+        {
+            fds.push_back({ STDIN_FILENO, POLLIN, 0 });
+            owners.push_back(nullptr);
+        }
+
+        if (fds.empty())
+            continue;
+
+        if (poll(fds.data(), fds.size(), -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        for (size_t j = 0; j < fds.size(); j++)
+        {
+            if (!fds[j].revents)
+                continue;
+
+            ParallelTask* task = owners[j];
+
+            if (!task)
+            {
+                ssize_t bytes_read = read_into(STDIN_FILENO, partial);
+
+                if (bytes_read == -1 && errno == EINTR)
+                    continue;
+
+                size_t start = 0;
+                size_t end;
+
+                while ((end = partial.find('\n', start)) != string::npos)
+                {
+                    inputs.emplace_back(partial, start, end - start);
+                    start = end + 1;
+                }
+
+                partial.erase(0, start);
+
+                if (bytes_read <= 0)
+                {
+                    if (!partial.empty())
+                        inputs.push_back(move(partial));
+
+                    partial.clear();
+                    reading = false;
+                }
+
+                continue;
+            }
+
+            int& fd = fds[j].fd == task->out ? task->out : task->err;
+            ssize_t bytes_read = read_into(fd, &fd == &task->out ? task->output : task->errors);
+
+            if (bytes_read > 0 || (bytes_read == -1 && errno == EINTR))
+                continue;
+
+            close(fd);
+            fd = -1;
+
+            if (task->out != -1 || task->err != -1)
+                continue;
+
+            int status = jobs.wait_child(task->pid);
+
+            task->status = exit_code(status);
+            running--;
+
+            // ^C reached the tasks, the shell ignores it so stopping is up to us
+            if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+            {
+                inputs.clear();
+                reading = false;
+            }
+        }
+    }
+
+    release_arena();
+
+    return min<size_t>(failed, 101);
+}
@@ -0,0 +1,153 @@
+#include <suggester.h>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <cerrno>
+#include <sys/eventfd.h>
+
+// resets the eventfd counter
+void drain(int fd)
+{
+    uint64_t count;
+
+    while (read(fd, &count, sizeof(count)) > 0);
+}
+
+Suggester::~Suggester()
+{
+    if (!state)
+        return;
+
+    std::lock_guard<std::mutex> guard(state->lock);
+
+    state->stop = true;
+    state->wake.notify_all();
+}
+
+int Suggester::fd()
+{
+    return state ? state->event_fd : -1;
+}
+
+void Suggester::post(uint64_t generation, const std::string& path, const std::string& word, std::shared_ptr<ExecIndex> index)
+{
+    if (!state)
+    {
+        state = std::make_shared<State>();
+        state->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        std::thread(run, state).detach();
+    }
+
+    // the previous request is still out, its answer won't be shown
+    if (waiting_for)
+        dropped++;
+
+    requests++;
+    waiting_for = generation;
+
+    std::lock_guard<std::mutex> guard(state->lock);
+
+    state->pending = true;
+    state->generation = generation;
+    state->path = path;
+    state->word = word;
+    state->index = index;
+    state->ready = false;
+
+    state->wake.notify_one();
+}
+
+// waits up to ms for the answer to generation, entry is empty when nothing matched
+bool Suggester::wait(uint64_t generation, int ms, std::string& entry)
+{
+    std::unique_lock<std::mutex> guard(state->lock);
+
+    auto answered = [&] { return state->ready && state->result_generation == generation; };
+
+    if (!state->done.wait_for(guard, std::chrono::milliseconds(ms), answered))
+        return false;
+
+    drain(state->event_fd);
+
+    state->ready = false;
+    entry = state->result;
+    waiting_for = 0;
+
+    return true;
+}
+
+// called once fd() is readable
+bool Suggester::take(uint64_t& generation, std::string& entry)
+{
+    drain(state->event_fd);
+
+    std::lock_guard<std::mutex> guard(state->lock);
+
+    if (!state->ready)
+        return false;
+
+    state->ready = false;
+    generation = state->result_generation;
+    entry = state->result;
+
+    if (generation == waiting_for)
+    {
+        waiting_for = 0;
+        late++;
+    }
+
+    return true;
+}
+
+void Suggester::run(std::shared_ptr<State> state)
+{
+    std::unique_lock<std::mutex> guard(state->lock);
+
+    while (true)
+    {
+        state->wake.wait(guard, [&] { return state->pending || state->stop; });
+
+        if (state->stop)
+            return;
+
+        uint64_t generation = state->generation;
+        std::string path = state->path;
+        std::string word = state->word;
+        std::shared_ptr<ExecIndex> index = std::move(state->index);
+
+        state->pending = false;
+
+        guard.unlock();
+
+        // dirs is only ever touched by this thread
+        std::string entry;
+
+        if (index)
+        {
+            if (!index->fresh(path))
+                index->rebuild(path);
+
+            if (!index->complete(word, entry))
+                entry.clear();
+        }
+        else if (!state->dirs.find(path, word, entry))
+            entry.clear();
+
+        guard.lock();
+
+        // a newer request came in while we were busy
+        if (state->pending)
+            continue;
+
+        state->ready = true;
+        state->result_generation = generation;
+        state->result = entry;
+
+        state->done.notify_all();
+
+        uint64_t one = 1;
+
+        while (write(state->event_fd, &one, sizeof(one)) == -1 && errno == EINTR);
+    }
+}
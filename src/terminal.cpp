@@ -1,6 +1,9 @@
 #include <terminal.h>
+#include <fcntl.h>
+#include <cerrno>
 
 termios original;
+Terminal terminal;
 
 void tty_raw()
 {
@@ -16,67 +19,131 @@ void tty_raw()
     raw.c_cc[VMIN] = 1;
     raw.c_cc[VTIME] = 1;
 
-    ret = tcsetattr(fileno(stdin), TCSAFLUSH, &raw);
+    ret = tcsetattr(fileno(stdin), TCSANOW, &raw);
     if (ret == -1)
         perror("tty_raw: tcsetattr");
 }
 
 void tty_restore()
 {
-    int ret = tcsetattr(fileno(stdin), TCSAFLUSH, &original);
+    int ret = tcsetattr(fileno(stdin), TCSANOW, &original);
     if (ret == -1)
         perror("tty_restore: tcsetattr");
 }
 
-void set_cursor(size_t pos)
+void on_resize(int)
 {
-    struct winsize size;
-    ioctl(STDIN_FILENO, TIOCGWINSZ, &size);
+    int saved = errno;
 
-    int line = pos / size.ws_col + 1;
-    int column = pos % size.ws_col + 1;
+    terminal.stale = 1;
 
-    printf("\e[%d;%dH", line, column);
+    if (write(terminal.resize_pipe[1], "", 1) == -1) {}
+
+    errno = saved;
 }
 
-size_t get_cursor()
+void watch_resize()
 {
-    if (write(STDOUT_FILENO, "\e[6n", 4) != 4)
-        return 0;
-
-    char buf[32];
-    size_t i = 0;
+    if (terminal.resize_pipe[0] != -1)
+        return;
 
-    while (i < sizeof(buf) - 1)
+    if (pipe2(terminal.resize_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
     {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
-            break;
+        perror("watch_resize: pipe");
+        return;
+    }
 
-        if (buf[i] == 'R')
-            break;
+    struct sigaction action = {};
+    action.sa_handler = on_resize;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
 
-        i++;
-    }
+    sigaction(SIGWINCH, &action, nullptr);
+}
 
-    buf[i] = '\0';
+int resize_fd()
+{
+    return terminal.resize_pipe[0];
+}
 
-    int line, column;
+// empties the pipe, true when a resize happened since the last call
+bool take_resize()
+{
+    char buf[64];
+    bool resized = false;
 
-    sscanf(&buf[2], "%d;%d", &line, &column);
+    while (terminal.resize_pipe[0] != -1 && read(terminal.resize_pipe[0], buf, sizeof(buf)) > 0)
+        resized = true;
 
-    struct winsize size;
-    ioctl(STDIN_FILENO, TIOCGWINSZ, &size);
+    return resized;
+}
 
-    return size.ws_col * (line - 1) + (column - 1);
+const winsize& get_size()
+{
+    if (terminal.stale)
+    {
+        terminal.stale = 0;
+
+        if (ioctl(STDIN_FILENO, TIOCGWINSZ, &terminal.size) == -1 || terminal.size.ws_col == 0)
+        {
+            terminal.size.ws_col = 80;
+            terminal.size.ws_row = 24;
+        }
+    }
+
+    return terminal.size;
 }
 
-void ajust_for_scroll(size_t* anchor, size_t offset)
+// column the cursor ends up in after text is printed from the start of a row,
+// escape sequences take no room and a full last row counts as wrapped
+// rows gets how many times the text moved down a row
+size_t end_column(std::string_view text, size_t cols, size_t& rows)
 {
-    struct winsize size;
-    ioctl(STDIN_FILENO, TIOCGWINSZ, &size);
+    size_t column = 0;
+
+    rows = 0;
 
-    int line = (*anchor + offset) / size.ws_col + 1;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char c = text[i];
+
+        if (c == '\e' && i + 1 < text.size())
+        {
+            char kind = text[++i];
+
+            // control sequences run up to their final byte,
+            // operating system commands up to BEL or ESC backslash
+            if (kind == '[')
+                while (++i < text.size() && !(text[i] >= 0x40 && text[i] <= 0x7e));
+            else if (kind == ']')
+                while (++i < text.size() && text[i] != '\a' && !(text[i] == '\\' && text[i - 1] == '\e'));
+
+            continue;
+        }
+
+        if (c == '\n')
+        {
+            column = 0;
+            rows++;
+        }
+        else if (c == '\r')
+            column = 0;
+        else if (c == '\t')
+            column = (column / 8 + 1) * 8 < cols ? (column / 8 + 1) * 8 : cols - 1;
+        else if (c == '\b')
+            column = column > 0 ? column - 1 : 0;
+        else if (c >= 0x20 && c != 0x7f && (c & 0xc0) != 0x80)
+        {
+            // utf-8 continuation bytes share the cell of their lead byte
+            if (column == cols)
+            {
+                column = 0;
+                rows++;
+            }
+
+            column++;
+        }
+    }
 
-    if (line > size.ws_row)
-        *anchor -= (line - size.ws_row) * size.ws_col;
+    return column;
 }
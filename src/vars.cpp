@@ -6,6 +6,9 @@ void Vars::set(const std::string& name, const std::string& value)
 
     if (is_exported(name))
         setenv(name.c_str(), data[name].c_str(), 1);
+
+    if (on_change)
+        on_change(name);
 }
 
 bool Vars::get(const std::string& name, std::string& value)
@@ -19,6 +22,24 @@ bool Vars::get(const std::string& name, std::string& value)
     return false;
 }
 
+// fallback when the variable is unset or not a number
+long long Vars::get_number(const std::string& name, long long fallback)
+{
+    std::string value;
+
+    if (!get(name, value))
+        return fallback;
+
+    try
+    {
+        return std::stoll(value);
+    }
+    catch (...)
+    {
+        return fallback;
+    }
+}
+
 bool Vars::unset(const std::string& name)
 {
     if (!contains(name))
@@ -32,6 +53,9 @@ bool Vars::unset(const std::string& name)
 
     data.erase(name);
 
+    if (on_change)
+        on_change(name);
+
     return true;
 }
 
@@ -0,0 +1,389 @@
+#include <wildcard.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+struct Entry
+{
+    string name;
+    unsigned char type;
+};
+
+// getdents64 hands over many entries per call, unlike readdir it needs no DIR
+static void read_entries(int fd, vector<Entry>& entries)
+{
+    alignas(dirent64) char buf[32768];
+    ssize_t len;
+
+    while ((len = getdents64(fd, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t pos = 0; pos < len;)
+        {
+            const dirent64* entry = reinterpret_cast<const dirent64*>(buf + pos);
+            const char* name = entry->d_name;
+
+            pos += entry->d_reclen;
+
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            entries.push_back({ name, entry->d_type });
+        }
+    }
+}
+
+// a [...] starting at pos, end is past its ] or npos when there is none
+static bool match_bracket(string_view pattern, size_t pos, unsigned char ch, size_t& end)
+{
+    size_t i = pos + 1;
+    bool negate = false;
+    bool matched = false;
+
+    if (i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^'))
+    {
+        negate = true;
+        i++;
+    }
+
+    // a ] right away is part of the set
+    for (bool first = true; i < pattern.size() && (pattern[i] != ']' || first); first = false)
+    {
+        if (pattern[i] == '\\' && i + 1 < pattern.size())
+            i++;
+
+        unsigned char low = pattern[i];
+        unsigned char high = low;
+
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']')
+        {
+            i += 2;
+
+            if (pattern[i] == '\\' && i + 1 < pattern.size())
+                i++;
+
+            high = pattern[i];
+        }
+
+        if (low <= ch && ch <= high)
+            matched = true;
+
+        i++;
+    }
+
+    if (i >= pattern.size())
+    {
+        end = string_view::npos;
+        return false;
+    }
+
+    end = i + 1;
+
+    return matched != negate;
+}
+
+bool has_wildcard(string_view pattern)
+{
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        if (pattern[i] == '\\')
+            i++;
+        else if (pattern[i] == '*' || pattern[i] == '?')
+            return true;
+        else if (pattern[i] == '[' && pattern.find(']', i + 2) != string_view::npos)
+            return true;
+    }
+
+    return false;
+}
+
+// the last * is tried again one character further on each mismatch,
+// which is enough since a later * can match anything an earlier one could
+bool wildcard_match(string_view pattern, string_view name)
+{
+    size_t p = 0;
+    size_t n = 0;
+    size_t star = string_view::npos;
+    size_t star_n = 0;
+
+    while (n < name.size())
+    {
+        if (p < pattern.size())
+        {
+            char ch = pattern[p];
+
+            if (ch == '*')
+            {
+                star = ++p;
+                star_n = n;
+                continue;
+            }
+
+            if (ch == '?')
+            {
+                p++;
+                n++;
+                continue;
+            }
+
+            size_t end;
+
+            if (ch == '[' && match_bracket(pattern, p, name[n], end))
+            {
+                p = end;
+                n++;
+                continue;
+            }
+
+            // without a closing ] it is a plain [
+            if (ch != '[' || end == string_view::npos)
+            {
+                size_t at = p;
+
+                if (ch == '\\' && p + 1 < pattern.size())
+                    ch = pattern[++at];
+
+                if (ch == name[n])
+                {
+                    p = at + 1;
+                    n++;
+                    continue;
+                }
+            }
+        }
+
+        if (star == string_view::npos)
+            return false;
+
+        p = star;
+        n = ++star_n;
+    }
+
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+
+    return p == pattern.size();
+}
+
+static string unescape(string_view text)
+{
+    string plain;
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '\\' && i + 1 < text.size())
+            i++;
+
+        plain += text[i];
+    }
+
+    return plain;
+}
+
+// dotfiles are only matched by a pattern that starts with a dot
+static bool component_match(string_view pattern, const string& name)
+{
+    if (name[0] == '.' && !pattern.starts_with(".") && !pattern.starts_with("\\."))
+        return false;
+
+    return wildcard_match(pattern, name);
+}
+
+// a walk below one directory shared by the pool, each directory read
+// queues its subdirectories, it is over once the queue is empty and idle
+struct Walk
+{
+    int root_fd = -1;
+    string_view leaf;
+    bool has_leaf = false;
+
+    mutex lock;
+    condition_variable wake;
+    vector<string> queue;
+    size_t busy = 0;
+
+    // directories as prefixes like "a/b/", and paths matching leaf
+    vector<string> dirs;
+    vector<string> matches;
+};
+
+static void walk_worker(Walk& walk)
+{
+    unique_lock<mutex> guard(walk.lock);
+
+    while (true)
+    {
+        walk.wake.wait(guard, [&] { return !walk.queue.empty() || walk.busy == 0; });
+
+        if (walk.queue.empty())
+            return;
+
+        string dir = move(walk.queue.back());
+        walk.queue.pop_back();
+        walk.busy++;
+
+        guard.unlock();
+
+        vector<string> subdirs;
+        vector<string> matches;
+        vector<Entry> entries;
+
+        int fd = openat(walk.root_fd, dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd != -1)
+        {
+            read_entries(fd, entries);
+
+            for (const Entry& entry : entries)
+            {
+                bool is_dir = entry.type == DT_DIR;
+
+                if (entry.type == DT_UNKNOWN)
+                {
+                    struct stat st;
+                    is_dir = fstatat(fd, entry.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+                }
+
+                if (walk.has_leaf && component_match(walk.leaf, entry.name))
+                    matches.push_back(dir + entry.name);
+
+                // like other shells, ** does not go into hidden directories or through symlinks
+                if (is_dir && entry.name[0] != '.')
+                    subdirs.push_back(dir + entry.name + "/");
+            }
+
+            close(fd);
+        }
+
+        guard.lock();
+
+        walk.dirs.insert(walk.dirs.end(), subdirs.begin(), subdirs.end());
+        walk.queue.insert(walk.queue.end(), make_move_iterator(subdirs.begin()), make_move_iterator(subdirs.end()));
+        walk.matches.insert(walk.matches.end(), make_move_iterator(matches.begin()), make_move_iterator(matches.end()));
+        walk.busy--;
+
+        walk.wake.notify_all();
+    }
+}
+
+// reads every directory below base with a thread per cpu, the calling one included
+static void walk_tree(const string& base, Walk& walk)
+{
+    walk.root_fd = open(base.empty() ? "." : base.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (walk.root_fd == -1)
+        return;
+
+    walk.queue.push_back("");
+    walk.dirs.push_back("");
+
+    size_t count = clamp<size_t>(thread::hardware_concurrency(), 1, 16);
+    vector<thread> pool;
+
+    for (size_t i = 1; i < count; i++)
+        pool.emplace_back(walk_worker, ref(walk));
+
+    walk_worker(walk);
+
+    for (thread& worker : pool)
+        worker.join();
+
+    close(walk.root_fd);
+}
+
+// prefix is empty or ends in a slash, parts are the components left
+static void expand_from(const string& prefix, const vector<string_view>& parts, size_t i, vector<string>& out)
+{
+    string_view part = parts[i];
+    bool last = i + 1 == parts.size();
+
+    if (!has_wildcard(part))
+    {
+        string path = prefix + unescape(part);
+        struct stat st;
+
+        if (!last)
+            expand_from(path + "/", parts, i + 1, out);
+        else if (!path.empty() && lstat(path.c_str(), &st) == 0)
+            out.push_back(path);
+
+        return;
+    }
+
+    if (part == "**")
+    {
+        Walk walk;
+
+        // the last component is matched during the walk, ** on its own matches all
+        if (last || (i + 2 == parts.size() && !parts[i + 1].empty()))
+        {
+            walk.leaf = last ? "*" : parts[i + 1];
+            walk.has_leaf = true;
+
+            walk_tree(prefix, walk);
+
+            for (const string& match : walk.matches)
+                out.push_back(prefix + match);
+
+            return;
+        }
+
+        walk_tree(prefix, walk);
+
+        for (const string& dir : walk.dirs)
+            expand_from(prefix + dir, parts, i + 1, out);
+
+        return;
+    }
+
+    vector<Entry> entries;
+    int fd = open(prefix.empty() ? "." : prefix.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1)
+        return;
+
+    read_entries(fd, entries);
+    close(fd);
+
+    for (const Entry& entry : entries)
+    {
+        if (!component_match(part, entry.name))
+            continue;
+
+        if (last)
+            out.push_back(prefix + entry.name);
+        else if (entry.type == DT_DIR || entry.type == DT_LNK || entry.type == DT_UNKNOWN)
+            expand_from(prefix + entry.name + "/", parts, i + 1, out);
+    }
+}
+
+vector<string> expand_wildcard(string_view pattern)
+{
+    vector<string_view> parts;
+    vector<string> matches;
+
+    while (true)
+    {
+        size_t slash = pattern.find('/');
+
+        parts.push_back(pattern.substr(0, slash));
+
+        if (slash == string_view::npos)
+            break;
+
+        pattern.remove_prefix(slash + 1);
+    }
+
+    expand_from("", parts, 0, matches);
+
+    sort(matches.begin(), matches.end());
+    matches.erase(unique(matches.begin(), matches.end()), matches.end());
+
+    return matches;
+}